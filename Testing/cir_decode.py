@@ -0,0 +1,73 @@
+import struct
+import sys
+
+# decoder for the CIR records on the debug UART (CIR_CAPTURE in main.cpp,
+# format in cir_capture.h), prints one CSV line per record:
+# seq, src, type, trigger, stamp_us, fp_index, first, rx_power, fp_power, |samples|...
+
+MAGIC = b'\xce\x1a'
+HEADER = '<BBBBIHHHff'
+HEADER_SIZE = 26
+TRIGGERS = {1: 'periodic', 2: 'anomaly', 3: 'command'}
+
+if len(sys.argv) < 2:
+    print("usage: %s <device> <baudrate> | %s <capture file>\n" % (sys.argv[0], sys.argv[0]))
+    sys.exit()
+
+if len(sys.argv) > 2:
+    import serial
+    port = serial.Serial(sys.argv[1], int(sys.argv[2]))
+    read = lambda: port.read(max(1, port.in_waiting))
+else:
+    capture = open(sys.argv[1], 'rb')
+    read = lambda: capture.read(1024)
+
+def checksum(data):
+    a = 0
+    b = 0
+    for c in bytearray(data):
+        a = (a + c) & 0xFF
+        b = (b + a) & 0xFF
+    return a, b
+
+buf = b''
+lastSeq = None
+lost = 0
+bad = 0
+while True:
+    chunk = read()
+    if not chunk:
+        break
+    buf += chunk
+    while True:
+        # debug prints share the UART, skip everything up to the magic
+        start = buf.find(MAGIC)
+        if start < 0:
+            buf = buf[-1:]
+            break
+        buf = buf[start:]
+        if len(buf) < 4:
+            break
+        length = struct.unpack('<H', buf[2:4])[0]
+        if length < HEADER_SIZE - 4 or length > 4096:
+            buf = buf[1:]
+            continue
+        end = 4 + length
+        if len(buf) < end + 2:
+            break
+        if checksum(buf[2:end]) != tuple(bytearray(buf[end:end + 2])):
+            bad += 1
+            buf = buf[1:]
+            continue
+        src, ftype, trigger, seq, stamp, fpIndex, first, count, rxPower, fpPower = \
+            struct.unpack(HEADER, buf[4:HEADER_SIZE])
+        samples = struct.unpack('<%dh' % (2 * count), buf[HEADER_SIZE:HEADER_SIZE + 4 * count])
+        buf = buf[end + 2:]
+        if lastSeq is not None:
+            lost += (seq - lastSeq - 1) & 0xFF
+        lastSeq = seq
+        magnitudes = ['%.0f' % ((samples[2 * i] ** 2 + samples[2 * i + 1] ** 2) ** 0.5) for i in range(count)]
+        print(','.join([str(seq), str(src), str(ftype), TRIGGERS.get(trigger, str(trigger)), str(stamp),
+                        '%.2f' % (fpIndex / 64.0), str(first), '%.1f' % rxPower, '%.1f' % fpPower] + magnitudes))
+
+sys.stderr.write("%d records lost, %d bad checksums\n" % (lost, bad))
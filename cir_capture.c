@@ -0,0 +1,90 @@
+#include "cir_capture.h"
+#include "libdw1000.h"
+#include "libdw1000Spi.h"
+#include "string.h"
+
+void cirTrigger_init(struct cirTrigger* t, uint16_t everyN) {
+    t->everyN = everyN;
+    t->frames = 0;
+    t->armedPeer = 0;
+    t->armed = 0;
+}
+
+void cirTrigger_arm(struct cirTrigger* t, uint8_t peer, uint8_t count) {
+    t->armedPeer = peer;
+    t->armed = count;
+}
+
+uint8_t cirTrigger_frame(struct cirTrigger* t, uint8_t src) {
+    if(t->armed && (t->armedPeer == 0 || t->armedPeer == src)) {
+        t->armed--;
+        return CIR_TRIGGER_COMMAND;
+    }
+    if(t->everyN == 0)
+        return 0;
+    if(++t->frames < t->everyN)
+        return 0;
+    t->frames = 0;
+    return CIR_TRIGGER_PERIODIC;
+}
+
+// the accumulator is only readable with its clocks forced on (FACE, AMCE, RXCLKS)
+static void accumulator_clocks(dwDevice_t* dev, int on) {
+    uint8_t pmsc[2];
+    dwSpiRead(dev, PMSC, PMSC_CTRL0_SUB, pmsc, 2);
+    pmsc[0] &= 0xB3;
+    pmsc[1] &= 0x7F;
+    if(on) {
+        pmsc[0] |= 0x48;
+        pmsc[1] |= 0x80;
+    }
+    dwSpiWrite(dev, PMSC, PMSC_CTRL0_SUB, pmsc, 2);
+}
+
+uint16_t cir_read(dwDevice_t* dev, struct cirCapture* c) {
+    uint16_t length = dev->pulseFrequency == TX_PULSE_FREQ_16MHZ ? CIR_LENGTH_16MHZ : CIR_LENGTH_64MHZ;
+    c->fpIndex = dwSpiRead16(dev, RX_TIME, CIR_FP_INDEX_SUB);
+    uint16_t fp = c->fpIndex >> 6;
+    c->first = fp > CIR_WINDOW_BEFORE ? fp - CIR_WINDOW_BEFORE : 0;
+    if(c->first + CIR_WINDOW_SAMPLES > length)
+        c->first = length - CIR_WINDOW_SAMPLES;
+    c->count = CIR_WINDOW_SAMPLES;
+    accumulator_clocks(dev, 1);
+    // every read starts with a dummy byte
+    uint8_t chunk[1 + 4 * CIR_CHUNK_SAMPLES];
+    for(uint16_t i = 0; i < c->count; i += CIR_CHUNK_SAMPLES) {
+        uint16_t n = c->count - i < CIR_CHUNK_SAMPLES ? c->count - i : CIR_CHUNK_SAMPLES;
+        dwSpiRead(dev, CIR_ACC_MEM, (c->first + i) * 4, chunk, 1 + 4 * n);
+        memcpy(&c->samples[2 * i], chunk + 1, 4 * n);
+    }
+    accumulator_clocks(dev, 0);
+    return c->count;
+}
+
+uint16_t cir_pack(const struct cirCapture* c, uint8_t sequence, uint8_t* out) {
+    uint16_t length = CIR_HEADER_SIZE - 4 + 4 * c->count;
+    out[0] = CIR_MAGIC_0;
+    out[1] = CIR_MAGIC_1;
+    memcpy(out + 2, &length, 2);
+    out[4] = c->src;
+    out[5] = c->type;
+    out[6] = c->trigger;
+    out[7] = sequence;
+    memcpy(out + 8, &c->stamp, 4);
+    memcpy(out + 12, &c->fpIndex, 2);
+    memcpy(out + 14, &c->first, 2);
+    memcpy(out + 16, &c->count, 2);
+    memcpy(out + 18, &c->rxPower, 4);
+    memcpy(out + 22, &c->fpPower, 4);
+    memcpy(out + CIR_HEADER_SIZE, c->samples, 4 * c->count);
+    uint16_t end = 4 + length;
+    uint8_t checksumA = 0;
+    uint8_t checksumB = 0;
+    for(uint16_t i = 2; i < end; i++) {
+        checksumA += out[i];
+        checksumB += checksumA;
+    }
+    out[end] = checksumA;
+    out[end + 1] = checksumB;
+    return end + 2;
+}
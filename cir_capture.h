@@ -0,0 +1,76 @@
+#ifndef __cir_capture_h
+#define __cir_capture_h
+
+#include "inttypes.h"
+#include "stddef.h"
+#include "libdw1000Types.h"
+
+// accumulator memory (channel impulse response) and first path index, not in dw1000.h
+#define CIR_ACC_MEM 0x25
+#define CIR_FP_INDEX_SUB 0x05
+// accumulator length in complex samples (int16 re, int16 im) per PRF
+#define CIR_LENGTH_16MHZ 992
+#define CIR_LENGTH_64MHZ 1016
+// captured window around the first path, a full CIR would take 4kB of SPI and UART
+#define CIR_WINDOW_BEFORE 16
+#define CIR_WINDOW_SAMPLES 64
+// samples per SPI read, the bus is free for other transfers in between
+#define CIR_CHUNK_SAMPLES 16
+
+// why a capture was taken
+#define CIR_TRIGGER_PERIODIC 1
+#define CIR_TRIGGER_ANOMALY 2
+#define CIR_TRIGGER_COMMAND 3
+
+/*
+ * record on the debug UART, little endian:
+ *  0 0xCE 0x1A magic
+ *  2 length (uint16, bytes from 4 to the checksum)
+ *  4 src, frame type, trigger, sequence (uint8 each, gaps in sequence are dropped records)
+ *  8 stamp (uint32, us)
+ * 12 first path index (uint16, 10.6 fixed point)
+ * 14 index of the first sample (uint16)
+ * 16 sample count (uint16)
+ * 18 rx power, first path power (float, dBm)
+ * 26 samples (int16 re, int16 im)
+ *    ck_a, ck_b over bytes 2..end of samples (as PPRZ)
+ */
+#define CIR_MAGIC_0 0xCE
+#define CIR_MAGIC_1 0x1A
+#define CIR_HEADER_SIZE 26
+#define CIR_RECORD_SIZE (CIR_HEADER_SIZE + 4 * CIR_WINDOW_SAMPLES + 2)
+
+struct cirCapture {
+    uint8_t src;
+    uint8_t type;
+    uint8_t trigger;
+    uint32_t stamp;
+    uint16_t fpIndex;
+    uint16_t first;
+    uint16_t count;
+    float rxPower;
+    float fpPower;
+    int16_t samples[2 * CIR_WINDOW_SAMPLES];
+};
+
+// decides which receptions are captured
+struct cirTrigger {
+    uint16_t everyN;        // every n-th ranging frame, 0 disables
+    uint16_t frames;
+    uint8_t armedPeer;      // 0 for any peer
+    uint8_t armed;          // captures left that were requested by command
+};
+
+void cirTrigger_init(struct cirTrigger* t, uint16_t everyN);
+// capture the next count ranging frames from peer (0 any)
+void cirTrigger_arm(struct cirTrigger* t, uint8_t peer, uint8_t count);
+// trigger for a ranging frame from src, 0 if it is not captured
+uint8_t cirTrigger_frame(struct cirTrigger* t, uint8_t src);
+
+// read the window around the first path of the last reception, has to run
+// before the receiver is enabled again. Returns the number of samples read
+uint16_t cir_read(dwDevice_t* dev, struct cirCapture* c);
+// write the capture as record into out (CIR_RECORD_SIZE bytes), returns its length
+uint16_t cir_pack(const struct cirCapture* c, uint8_t sequence, uint8_t* out);
+
+#endif // include guard
@@ -1,4 +1,5 @@
 #include "circular_buffer.h"
+#include "string.h"
 
 enum circularBufferStatus circularBuffer_status(struct circularBuffer* cb) {
     if(cb->head == cb->tail)
@@ -29,10 +30,22 @@ size_t circularBuffer_capacity(struct circularBuffer* cb) {
     return cb->size - 1 - circularBuffer_fill(cb);
 }
 
+// as writing element by element, the oldest bytes make room if needed
 int circularBuffer_write(struct circularBuffer* cb, uint8_t* Buf, size_t l) {
-    for(size_t i = 0; i < l; ++i) {
-        circularBuffer_write_element(cb, Buf[i]);
+    if(l > cb->size - 1) {
+        Buf += l - (cb->size - 1);
+        l = cb->size - 1;
     }
+    size_t free = circularBuffer_capacity(cb);
+    if(free < l)
+        circularBuffer_delete(cb, l - free);
+    struct circularBufferSpan span[2];
+    circularBuffer_write_spans(cb, span);
+    size_t first = l < span[0].length ? l : span[0].length;
+    memcpy(span[0].data, Buf, first);
+    if(l > first)
+        memcpy(span[1].data, Buf + first, l - first);
+    circularBuffer_commit(cb, l);
     return 1;
 }
 
@@ -53,7 +66,7 @@ uint8_t circularBuffer_read_element( struct circularBuffer* cb ) {
 }
 
 int circularBuffer_read(struct circularBuffer* cb, uint8_t* Buf, size_t l) {
-    if(circularBuffer_fill < l) {
+    if(circularBuffer_fill(cb) < l) {
         return 0; 
     }
     for(size_t i = 0; i<l; i++) {
@@ -79,6 +92,71 @@ void circularBuffer_delete(struct circularBuffer* cb, size_t n){
     cb->tail = (cb->tail + n) % cb->size;
 }
 
+static size_t spans(struct circularBuffer* cb, size_t start, size_t length, struct circularBufferSpan span[2]) {
+    size_t first = cb->size - start;
+    if(first > length)
+        first = length;
+    span[0].data = (uint8_t*)cb->data + start;
+    span[0].length = first;
+    span[1].data = (uint8_t*)cb->data;
+    span[1].length = length - first;
+    return length;
+}
+
+size_t circularBuffer_read_spans(struct circularBuffer* cb, struct circularBufferSpan span[2]) {
+    return spans(cb, cb->tail, circularBuffer_fill(cb), span);
+}
+
+// n up to the length of the read spans
+void circularBuffer_consume(struct circularBuffer* cb, size_t n) {
+    cb->tail = (cb->tail + n) % cb->size;
+}
+
+size_t circularBuffer_write_spans(struct circularBuffer* cb, struct circularBufferSpan span[2]) {
+    return spans(cb, cb->head, circularBuffer_capacity(cb), span);
+}
+
+// n up to the length of the write spans
+void circularBuffer_commit(struct circularBuffer* cb, size_t n) {
+    cb->head = (cb->head + n) % cb->size;
+}
+
+uint8_t circularBuffer_span_get(const struct circularBufferSpan span[2], size_t index) {
+    if(index < span[0].length)
+        return span[0].data[index];
+    return span[1].data[index - span[0].length];
+}
+
+void circularBuffer_span_skip(struct circularBufferSpan span[2], size_t n) {
+    if(n < span[0].length) {
+        span[0].data += n;
+        span[0].length -= n;
+        return;
+    }
+    n -= span[0].length;
+    span[0].data = span[1].data + n;
+    span[0].length = span[1].length - n;
+    span[1].length = 0;
+}
+
+void circularBuffer_span_limit(struct circularBufferSpan span[2], size_t length) {
+    if(length < span[0].length) {
+        span[0].length = length;
+        span[1].length = 0;
+        return;
+    }
+    length -= span[0].length;
+    if(length < span[1].length)
+        span[1].length = length;
+}
+
+void circularBuffer_span_copy(const struct circularBufferSpan span[2], uint8_t* out, size_t length) {
+    size_t first = length < span[0].length ? length : span[0].length;
+    memcpy(out, span[0].data, first);
+    if(length > first)
+        memcpy(out + first, span[1].data, length - first);
+}
+
 uint8_t* circularBuffer_getHead( struct circularBuffer *cb ) {
     return (uint8_t*)cb->data + cb->head;
 }
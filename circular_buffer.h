@@ -12,6 +12,12 @@ struct circularBuffer {
 
 enum circularBufferStatus {circularBuffer_FULL, circularBuffer_EMPTY, circularBuffer_OK};
 
+// contiguous piece of the buffer storage
+struct circularBufferSpan {
+    uint8_t* data;
+    size_t length;
+};
+
 void circularBuffer_init(struct circularBuffer* cb, uint8_t* p_data, size_t size);
 
 enum circularBufferStatus circularBuffer_status(struct circularBuffer* cb);
@@ -25,6 +31,22 @@ uint8_t circularBuffer_read_element( struct circularBuffer* cb );
 uint8_t circularBuffer_peek( struct circularBuffer* cb, size_t index );
 void circularBuffer_delete_all( struct circularBuffer* cb);
 void circularBuffer_delete(struct circularBuffer* cb, size_t n);
+
+// zero copy access: the next bytes to read resp. the free room, in up to two
+// pieces (the second one starts at the beginning of the storage, empty if
+// there is no wrap), returns their total length. SPI or DMA can work on the
+// pieces directly, nothing moves until consume resp. commit
+size_t circularBuffer_read_spans(struct circularBuffer* cb, struct circularBufferSpan span[2]);
+void circularBuffer_consume(struct circularBuffer* cb, size_t n);
+size_t circularBuffer_write_spans(struct circularBuffer* cb, struct circularBufferSpan span[2]);
+void circularBuffer_commit(struct circularBuffer* cb, size_t n);
+// on the two pieces: byte index, drop the first n bytes, keep only the first
+// length bytes, copy the first length bytes
+uint8_t circularBuffer_span_get(const struct circularBufferSpan span[2], size_t index);
+void circularBuffer_span_skip(struct circularBufferSpan span[2], size_t n);
+void circularBuffer_span_limit(struct circularBufferSpan span[2], size_t length);
+void circularBuffer_span_copy(const struct circularBufferSpan span[2], uint8_t* out, size_t length);
+
 uint8_t* circularBuffer_getHead( struct circularBuffer *cb );
 void circularBuffer_incrementHead( struct circularBuffer *cb );
 #endif // include guard
@@ -0,0 +1,87 @@
+#include "clock_drift.h"
+#include "ranging.h"
+
+static DriftEntry driftTable[DRIFT_TABLE_SIZE];
+
+void drift_init() {
+    for(uint8_t i = 0; i < DRIFT_TABLE_SIZE; i++) {
+        driftTable[i].addr = 0;
+        driftTable[i].samples = 0;
+        driftTable[i].rate = 1.0;
+    }
+}
+
+static DriftEntry* drift_find(uint8_t addr) {
+    for(uint8_t i = 0; i < DRIFT_TABLE_SIZE; i++) {
+        if(driftTable[i].addr == addr)
+            return &driftTable[i];
+    }
+    return 0;
+}
+
+// find the entry of addr, or take over a free one / the one with the least samples
+static DriftEntry* drift_entry(uint8_t addr) {
+    DriftEntry* entry = drift_find(addr);
+    if(entry)
+        return entry;
+    entry = &driftTable[0];
+    for(uint8_t i = 0; i < DRIFT_TABLE_SIZE; i++) {
+        if(driftTable[i].addr == 0) {
+            entry = &driftTable[i];
+            break;
+        }
+        if(driftTable[i].samples < entry->samples)
+            entry = &driftTable[i];
+    }
+    entry->addr = addr;
+    entry->samples = 0;
+    entry->rate = 1.0;
+    entry->lastLocal = 0;
+    entry->lastRemote = 0;
+    return entry;
+}
+
+static void drift_add_sample(DriftEntry* entry, double rate) {
+    if(rate > 1.0 + DRIFT_MAX_DEVIATION || rate < 1.0 - DRIFT_MAX_DEVIATION)
+        return;
+    if(entry->samples == 0) {
+        entry->rate = rate;
+    } else {
+        entry->rate += DRIFT_FILTER_GAIN * (rate - entry->rate);
+    }
+    if(entry->samples < 255)
+        entry->samples++;
+}
+
+void drift_update_from_exchange(uint8_t addr, const uint64_t& tRound1, const uint64_t& tReply1, const uint64_t& tRound2, const uint64_t& tReply2) {
+    // RANGE_0 tx -> RANGE_2 tx on the initiator spans the same time as
+    // RANGE_0 rx -> RANGE_2 rx on the responder, propagation cancels out
+    uint64_t remote = tReply1 + tRound2;
+    if(remote == 0)
+        return;
+    drift_add_sample(drift_entry(addr), (double)(tRound1 + tReply2) / remote);
+}
+
+void drift_update_from_timestamps(uint8_t addr, const dwTime_t* local, const dwTime_t* remote) {
+    DriftEntry* entry = drift_entry(addr);
+    if(entry->lastLocal != 0 || entry->lastRemote != 0) {
+        dwTime_t lastLocal = {.full = entry->lastLocal};
+        dwTime_t lastRemote = {.full = entry->lastRemote};
+        uint64_t dLocal;
+        uint64_t dRemote;
+        calculateDeltaTime(&lastLocal, (dwTime_t*)local, &dLocal);
+        calculateDeltaTime(&lastRemote, (dwTime_t*)remote, &dRemote);
+        if(dRemote != 0)
+            drift_add_sample(entry, (double)dLocal / dRemote);
+    }
+    entry->lastLocal = local->full;
+    entry->lastRemote = remote->full;
+}
+
+bool drift_get_rate(uint8_t addr, double* rate) {
+    DriftEntry* entry = drift_find(addr);
+    if(!entry || entry->samples < DRIFT_MIN_SAMPLES)
+        return false;
+    *rate = entry->rate;
+    return true;
+}
@@ -0,0 +1,37 @@
+#ifndef __clock_drift_h
+#define __clock_drift_h
+#include "inttypes.h"
+
+extern "C" {
+#include "libdw1000.h"
+}
+
+// number of peers whose clock rate is tracked at the same time
+#define DRIFT_TABLE_SIZE 16
+// weight of a new sample in the exponential rate filter
+#define DRIFT_FILTER_GAIN 0.25
+// samples further than this from 1.0 are treated as outliers (crystals are +-20ppm)
+#define DRIFT_MAX_DEVIATION 100e-6
+// samples needed before a rate is considered usable
+#define DRIFT_MIN_SAMPLES 2
+
+typedef struct DriftEntry {
+    uint8_t addr;       // 0 marks an unused entry
+    uint8_t samples;
+    double rate;        // local clock ticks per remote clock tick
+    uint64_t lastLocal;
+    uint64_t lastRemote;
+} DriftEntry;
+
+void drift_init();
+
+// update from a complete DS-TWR exchange (values as seen by the initiator)
+void drift_update_from_exchange(uint8_t addr, const uint64_t& tRound1, const uint64_t& tReply1, const uint64_t& tRound2, const uint64_t& tReply2);
+
+// update from a pair of timestamps of the same frame: local rx time, remote tx time
+void drift_update_from_timestamps(uint8_t addr, const dwTime_t* local, const dwTime_t* remote);
+
+// returns false if the rate of addr is not known well enough yet
+bool drift_get_rate(uint8_t addr, double* rate);
+
+#endif // include guard
@@ -0,0 +1,49 @@
+#include "frame_aggregator.h"
+
+void frameAggregator_init(struct frameAggregator* a, uint8_t* frame, uint16_t header, uint16_t capacity, uint32_t deadline) {
+    a->frame = frame;
+    a->header = header;
+    a->capacity = capacity;
+    a->nextCapacity = capacity;
+    a->maxCapacity = capacity;
+    a->length = 0;
+    a->deadline = deadline;
+    a->oldest = 0;
+    a->urgent = 0;
+}
+
+void frameAggregator_set_capacity(struct frameAggregator* a, uint16_t capacity) {
+    a->nextCapacity = capacity < a->maxCapacity ? capacity : a->maxCapacity;
+    if(a->length == 0)
+        a->capacity = a->nextCapacity;
+}
+
+int frameAggregator_fits(struct frameAggregator* a, uint16_t l) {
+    return a->length + l <= a->capacity;
+}
+
+uint8_t* frameAggregator_add(struct frameAggregator* a, uint16_t l, uint8_t priority, uint32_t now) {
+    if(a->length == 0)
+        a->oldest = now;
+    uint8_t* p = a->frame + a->header + a->length;
+    a->length += l;
+    if(priority)
+        a->urgent = 1;
+    return p;
+}
+
+int frameAggregator_due(struct frameAggregator* a, uint32_t now) {
+    if(a->length == 0)
+        return 0;
+    return a->urgent || now - a->oldest >= a->deadline;
+}
+
+uint16_t frameAggregator_take(struct frameAggregator* a) {
+    if(a->length == 0)
+        return 0;
+    uint16_t l = a->header + a->length;
+    a->length = 0;
+    a->capacity = a->nextCapacity;
+    a->urgent = 0;
+    return l;
+}
@@ -0,0 +1,38 @@
+#ifndef __frame_aggregator_h
+#define __frame_aggregator_h
+
+#include "inttypes.h"
+#include "stddef.h"
+
+/*
+ * Collects complete PPRZ messages from the autopilot into the payload of one
+ * DATA_FRAME, so the preamble and PHY header are paid once for all of them.
+ * The receiver already splits the payload with its PPRZ parser. A frame is due when
+ * the next message doesn't fit, when its oldest message waited for the
+ * deadline or when a priority message was added.
+ */
+struct frameAggregator {
+    uint8_t* frame;
+    uint16_t header;        // bytes in front of the payload, filled by the sender
+    uint16_t capacity;      // payload bytes of the current frame
+    uint16_t nextCapacity;  // from the next frame on
+    uint16_t maxCapacity;   // room in frame
+    uint16_t length;
+    uint32_t deadline;      // us
+    uint32_t oldest;        // us, arrival of the first message
+    uint8_t urgent;
+};
+
+// frame has room for header + capacity bytes
+void frameAggregator_init(struct frameAggregator* a, uint8_t* frame, uint16_t header, uint16_t capacity, uint32_t deadline);
+// payload limit (at most the capacity given to init), a frame already started keeps its own
+void frameAggregator_set_capacity(struct frameAggregator* a, uint16_t capacity);
+// room for a message of length l, a longer one never fits
+int frameAggregator_fits(struct frameAggregator* a, uint16_t l);
+// place for a message of length l (has to fit), priority makes the frame due
+uint8_t* frameAggregator_add(struct frameAggregator* a, uint16_t l, uint8_t priority, uint32_t now);
+int frameAggregator_due(struct frameAggregator* a, uint32_t now);
+// length of the frame including the header, 0 if it is empty. Empties the aggregator
+uint16_t frameAggregator_take(struct frameAggregator* a);
+
+#endif // include guard
@@ -1,21 +1,150 @@
 #include "mbed.h"
 #include "rtos.h"
+#include "math.h"
 #include "ranging.h"
+#include "clock_drift.h"
+#include "time_sync.h"
+#include "uart_dma.h"
 extern "C" {
 #include "libdw1000.h"
+#include "libdw1000Spi.h"
 #include "circular_buffer.h"
 #include "pprz.h"
+#include "range_batch.h"
+#include "neighbour_table.h"
+#include "multilateration.h"
+#include "rate_control.h"
+#include "range_quality.h"
+#include "ranging_stats.h"
+#include "range_rate.h"
+#include "cir_capture.h"
+#include "snapshot.h"
+#include "frame_aggregator.h"
+#include "routing_table.h"
+#include "telemetry_queue.h"
 }
+#include "spsc_ring.h"
 
 // ADDR should be same as AC_ID to match telemetry
+#ifndef ADDR
 #define ADDR 1
+#endif
 //#define SWITCH_UART
 #define ECHO 0
 #define PPRZ_MSG_ID 254
+#define PPRZ_BATCH_MSG_ID 253
+#define PPRZ_MM_MSG_ID 252
+#define PPRZ_POSITION_MSG_ID 251
+#define PPRZ_STATS_MSG_ID 250
+#define PPRZ_STATS_REQ_MSG_ID 249
+#define PPRZ_SWARM_TIME_MSG_ID 248
+#define PPRZ_CIR_REQ_MSG_ID 247
+#define PPRZ_MATRIX_MSG_ID 246
+// 1: solve the own position from ranges to anchorPositions and send POSITION
+#define POSITION_SOLVER 0
+#define POSITION_INTERVALL_MS 100
+// ranges older than this are not used for a position
+#define POSITION_MAX_AGE_US 500000
+// 1: ranges travel as int32 millimetres (RANGE_DATA_MM, RANGE_MM) instead of double
+#define COMPACT_RANGE 0
+// ranges per RANGE_BATCH report, 0 sends a RANGE message per range
+#define RANGE_BATCH_SIZE 8
+// a non empty batch is sent at the latest after this interval
+#define RANGE_BATCH_FLUSH_MS 50
+// ranging slot, each slot polls at most one neighbour that is due (see rate_control.h)
 #define RANGE_INTERVALL_US 3000
+// update of the adaptive ranging rate
+#define RATE_UPDATE_MS 100
+// 1: print the ranging rate decisions on the debug UART
+#define RATE_DEBUG 0
+#define RATE_DEBUG_MS 1000
+// 1: print every range on the debug UART, too slow to leave on in flight (use RANGING_STATS)
+#define RANGE_DEBUG 0
+// RANGING_DS_TWR: 5 frames per range, RANGING_SS_TWR: 2 frames, needs a known clock drift,
+// RANGING_DS3_TWR: 3 frames, the responder computes the range and returns it with its next response,
+// RANGING_SNAPSHOT: 2 frames per node and round for all pairs, every node gets the RANGE_MATRIX
+#define RANGING_MODE RANGING_DS_TWR
+// 1: RANGE_1/RANGE_2 are preloaded into the TX buffer and sent before any bookkeeping
+#define FAST_REPLY 1
+// delay between poll reception and scheduled single-sided response (1ms)
+#define SS_REPLY_DELAY 63897600
+// delay between response reception and scheduled RANGE_DS3_FINAL (0.5ms)
+#define FINAL_REPLY_DELAY 31948800
+// node that starts the snapshot rounds, with up to SNAPSHOT_MAX_NODES members
+#define SNAPSHOT_LEADER TIMESYNC_REFERENCE
+#define SNAPSHOT_INTERVALL_MS 100
+// delay between the last chain frame and the own scheduled report (1.5ms)
+#define SNAPSHOT_REPORT_DELAY 95846400
+// a slot silent for this long is skipped (us)
+#define SNAPSHOT_STALL_US 2500
+// node whose DW1000 clock is the swarm timebase, it broadcasts TIME_SYNC frames
+#define TIMESYNC_REFERENCE 1
+#define TIMESYNC_INTERVALL_MS 250
+// delay between reading the clock and the scheduled TIME_SYNC transmission (1ms)
+#define TIMESYNC_TX_DELAY 63897600
+// SWARM_TIME report to the autopilot
+#define SWARM_TIME_INTERVALL_MS 1000
 #define TELEMETRY_BAUD 38400
+// PPRZ framing of the autopilot link: 1, 2 (pprzlink 2.0, with destination and
+// class) or PPRZ_AUTO to detect it from the messages of the autopilot
+#define PPRZ_VERSION PPRZ_AUTO
+// class of the own messages and of forwarded v1 messages in v2 framing
+#define PPRZ_V2_CLASS PPRZ_CLASS_TELEMETRY
+// v1 ids of the control/safety messages of the autopilots, e.g.
+// -DPPRZ_CONTROL_MSG_IDS="{5, 9}". They come from the messages.xml of the
+// autopilot, v1 has no class and its telemetry and datalink ids overlap.
+// v2 messages of the datalink and alert class are control messages anyway
+#ifndef PPRZ_CONTROL_MSG_IDS
+#define PPRZ_CONTROL_MSG_IDS {0}
+#endif
+#define PPRZ_CONTROL_MSG_MAX 16
+// 1: receive frames up to 1023 bytes (non-standard PHR mode of the DW1000) and
+// send them to neighbours that announced the same, shorter frames stay compatible
+#define EXTENDED_FRAMES 1
+#if EXTENDED_FRAMES == 1
+#define MAX_FRAME LEN_EXT_UWB_FRAMES
+#else
+#define MAX_FRAME LEN_UWB_FRAMES
+#endif
+// DATA_FRAME payload: complete PPRZ messages up to the frame limit of all neighbours (- 2 FCS - 4 header)
+#define AGGREGATE_MAX_PAYLOAD (MAX_FRAME - 2 - NO_DATA_FRAME_SIZE)
+// longest wait of a message for others to share its frame (us), 0 sends what is there at once
+#define AGGREGATE_DEADLINE_US 5000
+// 1: v2 messages with a destination go as unicast DATA_FRAME to the node of that
+// AC_ID, received v2 messages for other autopilots are dropped before the UART
+#define UNICAST_ROUTING 1
+// 1: the telemetry port is received by circular DMA and handed over per burst
+// (idle line), falls back to the RxIrq per byte if the port has no DMA channel
+#define UART_DMA_RX 1
+#define UART_DMA_RX_SIZE 256
+// 1: UART messages are queued and sent by DMA, the caller doesn't wait for the
+// transmission. A message that doesn't fit into the queue of its class is dropped
+#define UART_DMA_TX 1
+// shared evenly by the control, ranging and bulk queue (telemetry_queue.h)
+#define UART_TX_QUEUE_SIZE 3072
+// a message of a lower class that waited this long goes ahead of a higher class
+#define UART_TX_MAX_WAIT_US 50000
+// 1: print the high-water marks of the telemetry queues on the debug UART
+#define UART_DEBUG 0
+#define UART_DEBUG_MS 1000
+// 1: time the PPRZ parser on a generated stream at startup, result on the debug UART
+#define PPRZ_PARSE_BENCH 0
 #define DEBUG_BAUD 115200
+// 1: stream channel impulse response captures on the debug UART (Testing/cir_decode.py)
+#define CIR_CAPTURE 0
+#define CIR_BAUD 921600
+// capture every n-th own ranging frame, 0 only on anomalies and CIR_REQ
+#define CIR_EVERY_N 50
+// a range is anomalous if it jumps by more than this from the last one (m) or is likely NLOS
+#define CIR_RANGE_JUMP 0.3
+#define CIR_NLOS_THRESHOLD 128
 #define IRQ_CHECKER_INTERVALL 100
+// every n-th ranging slot is used for a PING to discover new neighbours
+#define DISCOVERY_SLOTS 100
+// neighbours not heard from for this long are dropped
+#define NEIGHBOUR_TIMEOUT_US 3000000
+// consecutive failed exchanges after which a neighbour is dropped
+#define NEIGHBOUR_MAX_FAILURES 5
 #define IRQ_CHECKER_THRESHOLD 3
 
 volatile bool sending;
@@ -26,8 +155,90 @@ volatile bool sending;
       <field name="dest"                type="uint8"/>
       <field name="range"               type="double"/>
     </message>
+ * <message name="RANGE_MM" id="252">
+      <field name="src"                 type="uint8"/>
+      <field name="dest"                type="uint8"/>
+      <field name="range"               type="int32" unit="mm"/>
+      <field name="quality"             type="uint8"/>
+      <field name="nlos"                type="uint8"/>
+      <field name="range_rate"          type="int16" unit="mm/s"/>
+    </message>
+ * <message name="RANGE_BATCH" id="253">
+      <field name="stamp"               type="uint32" unit="ms"/>
+      <field name="ranges"              type="uint8[]"/>
+    </message>
+ * ranges holds 12 byte entries: src (uint8), dest (uint8), range (float),
+ * quality (uint8), nlos (uint8), range rate (int16, mm/s), ms since stamp (uint16)
+ * quality: 0 not rated, 1 (useless) .. 255 (best); nlos: non line of sight
+ * likelihood 0 .. 255, both from the receive diagnostics of the exchange;
+ * range rate: change of the range fitted over the last exchanges by the
+ * initiator, positive when moving apart, 0 until two ranges are known
+ * <message name="POSITION" id="251">
+      <field name="x"                   type="float" unit="m"/>
+      <field name="y"                   type="float" unit="m"/>
+      <field name="z"                   type="float" unit="m"/>
+      <field name="rms"                 type="float" unit="m"/>
+      <field name="anchors"             type="uint8"/>
+    </message>
+ * <message name="RANGING_STATS" id="250">
+      <field name="stamp"               type="uint32" unit="ms"/>
+      <field name="exchanges"           type="uint16[3]"/>
+      <field name="sent"                type="uint16[14]"/>
+      <field name="received"            type="uint16[14]"/>
+      <field name="aborted"             type="uint16[14]"/>
+      <field name="turnaround"          type="uint16[16]"/>
+      <field name="exchange_time"       type="uint16[16]"/>
+      <field name="peers"               type="uint8[]"/>
+    </message>
+ * exchanges: started, completed, aborted as initiator; sent, received and
+ * aborted (last phase reached) are indexed by frame type RANGE_0..RANGE_DS3_FINAL;
+ * histogram bin k counts 2^k..2^(k+1)-1 us; peers holds 7 byte entries:
+ * addr (uint8), attempts (uint16), successes (uint16), range std dev (uint16, mm)
+ * <message name="RANGING_STATS_REQ" id="249">
+      <field name="reset"               type="uint8"/>
+    </message>
+ * sent by the autopilot to the node, which answers with RANGING_STATS
+ * <message name="SWARM_TIME" id="248">
+      <field name="swarm_time"          type="uint32" unit="us"/>
+      <field name="local_time"          type="uint32" unit="us"/>
+      <field name="skew"                type="float" unit="ppm"/>
+      <field name="reference"           type="uint8"/>
+      <field name="sync_age"            type="uint16" unit="ms"/>
+    </message>
+ * swarm_time is the clock of the reference node at local_time (the clock of
+ * the RANGE_BATCH stamps), only sent while the node is synchronized
+ * <message name="CIR_REQ" id="247">
+      <field name="peer"                type="uint8"/>
+      <field name="count"               type="uint8"/>
+      <field name="every"               type="uint16"/>
+    </message>
+ * sent by the autopilot to the node: capture the next count ranging frames
+ * from peer (0 any) and then every n-th frame (0 off), see cir_capture.h
+ * <message name="RANGE_MATRIX" id="246">
+      <field name="stamp"               type="uint32" unit="ms"/>
+      <field name="round"               type="uint8"/>
+      <field name="nodes"               type="uint8[]"/>
+      <field name="ranges"              type="int16[]" unit="cm"/>
+    </message>
+ * result of a snapshot round (RANGING_SNAPSHOT): ranges between nodes[i] and
+ * nodes[j] for all i < j in the order (0,1), (0,2) .. (1,2) .., INT16_MIN if missing
  * */
 
+// PPRZ_CONTROL_MSG_IDS, 0 ends the list. Control messages to other nodes go out
+// at once, to the autopilot ahead of ranging and bulk telemetry
+static const uint8_t controlMsgIds[PPRZ_CONTROL_MSG_MAX] = PPRZ_CONTROL_MSG_IDS;
+
+// known anchor positions for the position solver: addr, x, y, z (m)
+// anchors range as ordinary nodes, their addrs must not collide with the ADDR
+// of any mobile node, ranges to a mobile node with an anchor's addr would be
+// taken for that anchor. Anchors here take 101 and up, mobile nodes stay below
+static const struct mlatAnchor anchorPositions[] = {
+    {101, 0.0f, 0.0f, 0.0f},
+    {102, 10.0f, 0.0f, 0.0f},
+    {103, 0.0f, 10.0f, 0.0f},
+    {104, 10.0f, 10.0f, 3.0f},
+};
+
 DigitalOut redLed(LED2);
 DigitalOut greenLed(LED1);
 SPI spi(SPI_MOSI, SPI_MISO, SPI_SCK);
@@ -35,22 +246,83 @@ DigitalOut cs(SPI_CS);
 InterruptIn sIRQ(PA_0);
 DigitalInOut sReset(PA_1);
 #ifdef SWITCH_UART
-RawSerial uart1(PA_2, PA_3, TELEMETRY_BAUD);
+#define TELEMETRY_TX PA_2
+#define TELEMETRY_RX PA_3
+RawSerial uart1(TELEMETRY_TX, TELEMETRY_RX, TELEMETRY_BAUD);
 RawSerial uart2(PA_9, PA_10, DEBUG_BAUD);
 #else
-RawSerial uart1(PA_9, PA_10, TELEMETRY_BAUD);
+#define TELEMETRY_TX PA_9
+#define TELEMETRY_RX PA_10
+RawSerial uart1(TELEMETRY_TX, TELEMETRY_RX, TELEMETRY_BAUD);
 RawSerial uart2(PA_2, PA_3, DEBUG_BAUD);
 #endif
-circularBuffer UARTcb;
-circularBuffer DWMcb;
-uint8_t UARTcb_data[256];
-uint8_t DWMcb_data[256];
+struct rangeBatch rangeBatch;
+struct mlat mlat;
+struct rateControl rateControl;
+struct rangingStats rangingStats;
+struct snapshot snapshot;
+uint8_t snapshotRound;
+// slot of the snapshot frame being sent, frames up to a report of SNAPSHOT_MAX_NODES
+uint8_t snapshotTxSlot;
+uint8_t snapshotFrame[NO_DATA_FRAME_SIZE + SNAPSHOT_HEADER_SIZE + SNAPSHOT_REPORT_SIZE(SNAPSHOT_MAX_NODES)];
+struct frameAggregator aggregator;
+uint8_t aggregatorFrame[NO_DATA_FRAME_SIZE + AGGREGATE_MAX_PAYLOAD];
+// UWB destination of the messages in aggregator
+uint8_t aggregateDest;
+// PPRZ version of the messages in aggregator, sent as the DATA_FRAME type
+uint8_t aggregateVersion;
+// length of the DATA_FRAME in aggregatorFrame waiting for the ranging thread, 0 none
+volatile uint16_t aggregatePending;
+// learned by the ranging thread, looked up by the main loop
+struct routingTable routes;
+// received messages for other autopilots, dropped
+uint32_t foreignMessages;
+// autopilot to UWB, filled by the UART interrupt
+SpscRing<256> UARTcb;
+// UWB to autopilot, filled by the ranging thread, room for a few frames of PPRZ messages.
+// Each frame is stored as version, length (uint16) and its payload
+SpscRing<2048> DWMcb;
+#define DWM_FRAME_HEADER 3
+struct pprzParser uartParser;
+// the autopilots on the radio use either version, parsed per frame with the
+// version of its sender
+struct pprzParser dwmParser;
+// payload bytes of the frame dwmParser is on, not consumed yet
+uint16_t dwmFrameLeft;
+#if UART_DMA_RX == 1
+uint8_t uartDmaRx_data[UART_DMA_RX_SIZE];
+#endif
+#if UART_DMA_TX == 1
+// messages to the autopilot by class, the DMA sends one piece at a time
+struct telemetryQueue uartTx;
+uint8_t uartTx_data[UART_TX_QUEUE_SIZE];
+// bytes of the running transfer, 0 while the DMA is idle
+volatile uint16_t uartTxLength;
+bool uartTxDma;
+#endif
+// high-water marks of the telemetry queues (bytes)
+size_t uartTxHighWater;
+size_t uartRxHighWater;
+#if CIR_CAPTURE == 1
+struct cirTrigger cirTrigger;
+// records waiting for the debug UART, written by the ranging thread
+circularBuffer CIRcb;
+uint8_t CIRcb_data[1024];
+uint8_t cirSequence;
+#endif
+// set while handling a frame whose range looks wrong, see check_anomaly
+bool cirAnomaly;
 EventQueue IRQqueue(32 * EVENTS_EVENT_SIZE);
 EventQueue DWMqueue(16 * EVENTS_EVENT_SIZE);
 Thread t_irq;
 void dwIRQFunction();
 void DWMReceive();
 void send_pprz_range_message(uint8_t src, uint8_t dest, double range);
+void report_range(uint8_t src, uint8_t dest, double range, uint8_t quality, uint8_t nlos, float rate);
+void sendUART(uint8_t* data, int length, uint8_t cls);
+void sendUARTSpans(struct circularBufferSpan span[2], size_t length, uint8_t cls);
+void sendPPRZ(uint8_t* message, uint8_t length);
+void transmit_aggregate();
 uint8_t irq_checker_count = 0;
 /* variables for ranging*/
 
@@ -65,10 +337,34 @@ uint64_t tRound1;
 uint64_t tReply1;
 uint64_t tRound2;
 uint64_t tReply2;
-uint8_t knownNodes[32];
+struct neighbourTable neighbours;
+// smallest frame limit of all neighbours, kept by the ranging thread: the main
+// loop must not walk the table while neighbourTable_remove compacts it
+volatile uint16_t broadcastFrameLimit = NEIGHBOUR_STANDARD_FRAME;
+// receive diagnostics of the frames of the current exchange
+struct rangeQuality exchangeQuality;
+uint8_t rangingPeer = NEIGHBOUR_NONE;
+// initiator of the 3 frame exchange this node responded to last
+uint8_t ds3Peer = NEIGHBOUR_NONE;
+// responder: initiator whose exchange still needs a frame from this node or
+// its final, since replyTime. NEIGHBOUR_NONE if none is open
+uint8_t replyPeer = NEIGHBOUR_NONE;
+uint32_t replyTime;
+bool rangingDone = true;
+uint8_t discoverySlot;
+// half a discovery period away from the PINGs of the ranging nodes
+uint8_t announceSlot = DISCOVERY_SLOTS / 2;
 double tPropTick;
 DFrame txFrame;
 DFrame rxFrame;
+// received snapshot frames, DATA_FRAME payload goes straight to DWMcb
+uint8_t Buffer[LEN_UWB_FRAMES];
+// frames not sent because they were too long for the radio or a neighbour,
+// counted by both threads
+uint32_t oversizeFrames;
+// reply waiting in the DW1000 TX buffer, see preload_reply
+DFrame txPreload;
+bool preloaded = false;
 
 
 static void spiWrite(dwDevice_t* dev, const void* header, size_t headerLength,
@@ -140,8 +436,20 @@ static dwOps_t ops = {
 dwDevice_t dwm_device;
 dwDevice_t* dwm = &dwm_device;
 
+// dwSetData would drop the frame silently
+bool frame_fits(int length) {
+    if(length + 2 <= (dwm->extendedFrameLength ? LEN_EXT_UWB_FRAMES : LEN_UWB_FRAMES))
+        return true;
+    core_util_atomic_incr_u32(&oversizeFrames, 1);
+    return false;
+}
+
 void sendDWM(uint8_t* data, int length) {
+    if(!frame_fits(length))
+        return;
     sending = true;
+    preloaded = false;
+    rateControl_tx(&rateControl, length);
     spi.lock();
     dwNewTransmit(dwm);
     dwSetData(dwm, data, length);
@@ -149,20 +457,242 @@ void sendDWM(uint8_t* data, int length) {
     spi.unlock();
 }
 
+// transmit at txTime (device time, lowest 9 bits are ignored by the DW1000)
+void sendDWMDelayed(uint8_t* data, int length, dwTime_t txTime) {
+    if(!frame_fits(length))
+        return;
+    sending = true;
+    preloaded = false;
+    rateControl_tx(&rateControl, length);
+    spi.lock();
+    dwNewTransmit(dwm);
+    dwSetData(dwm, data, length);
+    dwSetTxRxTime(dwm, txTime);
+    dwStartTransmit(dwm);
+    spi.unlock();
+}
+
 void send_rp(FrameType type) {
     txFrame.type = type;
     txFrame.src = ADDR;
     txFrame.dest = rxFrame.src;
     txFrame.seq++;
     sendDWM((uint8_t*)&txFrame, NO_DATA_FRAME_SIZE);
+    rangingStats_sent(&rangingStats, type, txFrame.dest);
+}
+
+// header of a snapshot frame, txcallback takes the type from txFrame
+uint8_t* snapshot_header(FrameType type, uint8_t slot) {
+    txFrame.type = type;
+    txFrame.seq++;
+    snapshotTxSlot = slot;
+    snapshotFrame[0] = ADDR;
+    snapshotFrame[1] = 0;
+    snapshotFrame[2] = type;
+    snapshotFrame[3] = txFrame.seq;
+    snapshotFrame[4] = snapshot.round;
+    snapshotFrame[5] = slot;
+    return snapshotFrame + NO_DATA_FRAME_SIZE + SNAPSHOT_HEADER_SIZE;
+}
+
+// PING and PONG announce the longest frame the sender receives
+void send_discovery(FrameType type) {
+    uint16_t maxFrame = MAX_FRAME;
+    txFrame.type = type;
+    txFrame.src = ADDR;
+    txFrame.dest = rxFrame.src;
+    txFrame.seq++;
+    memcpy(txFrame.data, &maxFrame, DISCOVERY_SIZE);
+    sendDWM((uint8_t*)&txFrame, NO_DATA_FRAME_SIZE + DISCOVERY_SIZE);
+    rangingStats_sent(&rangingStats, type, txFrame.dest);
+}
+
+// nodes that don't range themselves still announce their frame limit: their
+// PONGs to the PINGs of others collide with each other, and a broadcast PONG
+// asks no one to answer
+void announce_frame_limit() {
+    if(++announceSlot < DISCOVERY_SLOTS)
+        return;
+    if(sending || snapshot.active)
+        return;
+    announceSlot = 0;
+    rxFrame.src = 0;
+    send_discovery(PONG);
+}
+
+// after every change of the neighbours or their frame limits
+void publish_frame_limit() {
+    broadcastFrameLimit = neighbourTable_frame_limit(&neighbours, 0);
+}
+
+void receive_discovery() {
+    // without payload from older firmware, the neighbour keeps standard frames
+    if(dwGetDataLength(dwm) < NO_DATA_FRAME_SIZE + DISCOVERY_SIZE)
+        return;
+    uint16_t maxFrame;
+    dwGetData(dwm, (uint8_t*) &rxFrame, NO_DATA_FRAME_SIZE + DISCOVERY_SIZE);
+    memcpy(&maxFrame, rxFrame.data, DISCOVERY_SIZE);
+    neighbourTable_set_max_frame(&neighbours, rxFrame.src, maxFrame);
+    publish_frame_limit();
+}
+
+// write the expected reply into the TX buffer while receiving, the poll
+// then only needs the start command (and its sender as destination)
+void preload_reply(FrameType type, uint8_t dest) {
+    txPreload.type = type;
+    txPreload.src = ADDR;
+    txPreload.dest = dest;
+    txPreload.seq = txFrame.seq + 1;
+    spi.lock();
+    dwSetData(dwm, (uint8_t*)&txPreload, NO_DATA_FRAME_SIZE);
+    spi.unlock();
+    preloaded = true;
+}
+
+// send the preloaded reply to rxFrame.src, false if a different reply is preloaded
+bool send_preloaded(FrameType type) {
+    if(!preloaded || txPreload.type != type)
+        return false;
+    sending = true;
+    preloaded = false;
+    spi.lock();
+    if(txPreload.dest != rxFrame.src) {
+        txPreload.dest = rxFrame.src;
+        dwSpiWrite8(dwm, TX_BUFFER, 1, txPreload.dest);
+    }
+    dwNewTransmit(dwm);
+    dwStartTransmit(dwm);
+    spi.unlock();
+    // txcallback reads the timestamps according to txFrame.type
+    memcpy(&txFrame, &txPreload, NO_DATA_FRAME_SIZE);
+    rateControl_tx(&rateControl, NO_DATA_FRAME_SIZE);
+    rangingStats_sent(&rangingStats, type, txFrame.dest);
+    return true;
+}
+
+// answer the timing critical DS-TWR frames, returns false if the normal path has to
+bool fast_reply() {
+#if FAST_REPLY == 1
+    switch(rxFrame.type) {
+        case RANGE_0:
+            return send_preloaded(RANGE_1);
+        case RANGE_1:
+            return send_preloaded(RANGE_2);
+    }
+#endif
+    return false;
+}
+
+void register_node(float rxPower) {
+    uint8_t count = neighbourTable_count(&neighbours);
+    neighbourTable_seen(&neighbours, rxFrame.src, us_ticker_read(), rxPower);
+    // a new neighbour starts with standard frames
+    if(neighbourTable_count(&neighbours) != count)
+        publish_frame_limit();
+}
+
+// reads the frame into rxFrame with up to size payload bytes. Firmware before the
+// quality and range rate fields sends shorter payloads, the missing bytes are 0
+// (not rated, rate unknown). Returns the payload length
+size_t read_frame(size_t size) {
+    size_t length = dwGetDataLength(dwm);
+    length = length > NO_DATA_FRAME_SIZE ? length - NO_DATA_FRAME_SIZE : 0;
+    if(length > size)
+        length = size;
+    memset(rxFrame.data + length, 0, size - length);
+    dwGetData(dwm, (uint8_t*) &rxFrame, NO_DATA_FRAME_SIZE + length);
+    return length;
+}
+
+// the frames whose timestamps the range is computed from on this node
+void record_quality(float rxPower) {
+    switch(rxFrame.type) {
+        case RANGE_0:
+        case RANGE_DS3_POLL:
+            // the poll starts the exchange as responder
+            rangeQuality_reset(&exchangeQuality);
+            /* fall through */
+        case RANGE_1:
+        case RANGE_2:
+        case RANGE_SS_RESP:
+        case RANGE_DS3_RESP:
+        case RANGE_DS3_FINAL:
+            rangeQuality_add(&exchangeQuality, rxPower, dwGetFirstPathPower(dwm), dwGetReceiveQuality(dwm));
+            break;
+    }
+}
+
+// range computed on this node, stamp is the poll of the exchange. Returns the range rate to addr
+float range_measured(uint8_t addr, double range, const dwTime_t* stamp) {
+    uint32_t now = us_ticker_read();
+    neighbourTable_exchange_done(&neighbours, addr, range, stamp->full & TIMESYNC_DEVICE_MASK, now);
+    mlat_add_range(&mlat, addr, range, now);
+    rangingStats_range(&rangingStats, addr, range, now);
+    struct neighbour* n = neighbourTable_get(&neighbours, addr);
+    return n ? n->rangeRate.rate : RANGE_RATE_UNKNOWN;
 }
 
-void register_node() {
-    uint8_t addr = rxFrame.src;
-    knownNodes[addr/32] |= 1 << (addr % 8);
+// the own exchange with addr as initiator finished
+void exchange_done(uint8_t addr) {
+    rangingStats_done(&rangingStats, addr, us_ticker_read());
+    if(addr == rangingPeer)
+        rangingDone = true;
+}
+
+// range computed as initiator, returns the range rate to addr
+float range_done(uint8_t addr, double range) {
+    float rate = range_measured(addr, range, &tStartRound1);
+    exchange_done(addr);
+    return rate;
+}
+
+// the previous exchange is counted as lost if it never finished, dead neighbours are dropped
+void finish_ranging_slot(uint32_t now) {
+    if(!rangingDone) {
+        rangingStats_abort(&rangingStats);
+        neighbourTable_exchange_failed(&neighbours, rangingPeer);
+        struct neighbour* n = neighbourTable_get(&neighbours, rangingPeer);
+        if(n && n->failures >= NEIGHBOUR_MAX_FAILURES)
+            neighbourTable_remove(&neighbours, rangingPeer);
+    }
+    neighbourTable_expire(&neighbours, now, NEIGHBOUR_TIMEOUT_US);
+    publish_frame_limit();
+    rangingDone = true;
+}
+
+// next live neighbour in round robin order whose poll is due, NEIGHBOUR_NONE if none is
+uint8_t next_ranging_peer(uint32_t now) {
+    uint8_t peer = rangingPeer;
+    for(uint8_t i = 0; i < neighbourTable_count(&neighbours); i++) {
+        peer = neighbourTable_next(&neighbours, peer);
+        struct neighbour* n = neighbourTable_get(&neighbours, peer);
+        if((int32_t)(now - n->nextPoll) >= 0) {
+            n->nextPoll = now + rateControl_interval(&rateControl, n);
+            rangingPeer = peer;
+            return peer;
+        }
+    }
+    return NEIGHBOUR_NONE;
+}
+
+void update_ranging_rate() {
+    float queueFill = (float)UARTcb.fill() / UARTcb.capacity();
+    rateControl_update(&rateControl, us_ticker_read(), queueFill, neighbourTable_loss(&neighbours));
+}
+
+void print_ranging_rate() {
+    uart2.printf("rate: load %u%% queue %u%% loss %u%% scale %u.%02u\r\n", (unsigned)(rateControl.load * 100),
+            (unsigned)(rateControl.queue * 100), (unsigned)(rateControl.loss * 100), (unsigned)rateControl.scale, (unsigned)(rateControl.scale * 100) % 100);
+    for(uint8_t i = 0; i < neighbourTable_count(&neighbours); i++) {
+        struct neighbour* n = neighbourTable_at(&neighbours, i);
+        uart2.printf("  %u: every %lu ms, loss %u%%, %d mm/s\r\n", n->addr,
+                (unsigned long)(rateControl_interval(&rateControl, n) / 1000),
+                (unsigned)(n->lossRate * 100), (int)(n->rangeRate.rate * 1000));
+    }
 }
 
 void send_range_transfer() {
+    replyPeer = NEIGHBOUR_NONE;
     dwGetReceiveTimestamp(dwm, &tEndRound2);
    	txFrame.type = RANGE_TRANSFER;
     txFrame.src = ADDR;
@@ -171,28 +701,411 @@ void send_range_transfer() {
 	memcpy(txFrame.data, tStartReply1.raw, 5);
 	memcpy((txFrame.data+5), tEndReply1.raw, 5);
 	memcpy((txFrame.data+10), tEndRound2.raw, 5);
-    sendDWM((uint8_t *)&txFrame, 19);
+    // the initiator only sees its own receptions, add the rating of RANGE_0 and RANGE_2
+    txFrame.data[15] = rangeQuality_score(&exchangeQuality);
+    txFrame.data[16] = rangeQuality_nlos(&exchangeQuality);
+    sendDWM((uint8_t *)&txFrame, NO_DATA_FRAME_SIZE + RANGE_TRANSFER_SIZE);
+    rangingStats_sent(&rangingStats, RANGE_TRANSFER, txFrame.dest);
 }
 
-void send_range(double range) {
-   	txFrame.type = RANGE_DATA;
+void send_range(double range, uint8_t quality, uint8_t nlos, float rate) {
+    int16_t rateMm = rangeRate_to_mm(rate);
     txFrame.src = ADDR;
     txFrame.dest = rxFrame.src;
     txFrame.seq++;
+#if COMPACT_RANGE == 1
+   	txFrame.type = RANGE_DATA_MM;
+    int32_t mm = rangeToMillimetres(range);
+	memcpy(txFrame.data, &mm, sizeof(mm));
+    txFrame.data[sizeof(mm)] = quality;
+    txFrame.data[sizeof(mm)+1] = nlos;
+    memcpy(txFrame.data+sizeof(mm)+2, &rateMm, sizeof(rateMm));
+    sendDWM((uint8_t *)&txFrame, NO_DATA_FRAME_SIZE + RANGE_MM_SIZE);
+#else
+   	txFrame.type = RANGE_DATA;
 	memcpy(txFrame.data, &range, sizeof(range));
-    sendDWM((uint8_t *)&txFrame, NO_DATA_FRAME_SIZE + sizeof(range));
+    txFrame.data[sizeof(range)] = quality;
+    txFrame.data[sizeof(range)+1] = nlos;
+    memcpy(txFrame.data+sizeof(range)+2, &rateMm, sizeof(rateMm));
+    sendDWM((uint8_t *)&txFrame, NO_DATA_FRAME_SIZE + RANGE_DATA_SIZE);
+#endif
+    rangingStats_sent(&rangingStats, txFrame.type, txFrame.dest);
+#if RANGE_DEBUG == 1
     uart2.printf("%u, %u, %Lf\r\n", txFrame.src, txFrame.dest, range);
-     
+#endif
 }
 
 void startRanging() {
-    rxFrame.src = 1;
+    uint32_t now = us_ticker_read();
+    finish_ranging_slot(now);
+#if RANGING_MODE == RANGING_SNAPSHOT
+    // a PING would take the slot of a member
+    if(snapshot.active)
+        return;
+#endif
+    if(++discoverySlot >= DISCOVERY_SLOTS) {
+        discoverySlot = 0;
+        rxFrame.src = 0;
+        send_discovery(PING);
+        return;
+    }
+#if RANGING_MODE == RANGING_SNAPSHOT
+    // pairs are ranged in the rounds of the leader
+    return;
+#endif
+    uint8_t peer = next_ranging_peer(now);
+    if(peer == NEIGHBOUR_NONE) {
+        // nobody due, leave the airtime to telemetry
+        return;
+    }
+    rangingDone = false;
+    rangingStats_start(&rangingStats, peer, now);
+    rangeQuality_reset(&exchangeQuality);
+    rxFrame.src = peer;
+#if RANGING_MODE == RANGING_SS_TWR
+    send_rp(RANGE_SS_POLL);
+#elif RANGING_MODE == RANGING_DS3_TWR
+    send_rp(RANGE_DS3_POLL);
+#else
     send_rp(RANGE_0);
+#endif
+}
+
+// TIME_SYNC at a scheduled time, so its swarm time is known before the transmission
+void send_time_sync() {
+    if(sending || !rangingDone || snapshot.active)
+        return;
+    // keep the channel free for open exchanges, as transmit_aggregate
+    if(replyPeer != NEIGHBOUR_NONE && us_ticker_read() - replyTime < RANGE_INTERVALL_US)
+        return;
+    dwTime_t tNow;
+    spi.lock();
+    dwGetSystemTimestamp(dwm, &tNow);
+    spi.unlock();
+    dwTime_t tTx = {.full = (tNow.full + TIMESYNC_TX_DELAY) & 0xFFFFFFFE00};
+    dwTime_t tStamp = {.full = (tTx.full + dwm->antennaDelay.full) & TIMESYNC_DEVICE_MASK};
+    uint64_t swarm = timesync_extend(&tStamp);
+    txFrame.type = TIME_SYNC;
+    txFrame.src = ADDR;
+    txFrame.dest = 0;
+    txFrame.seq++;
+    memcpy(txFrame.data, &swarm, TIMESYNC_STAMP_SIZE);
+    sendDWMDelayed((uint8_t *)&txFrame, NO_DATA_FRAME_SIZE + TIMESYNC_STAMP_SIZE, tTx);
+}
+
+void receive_time_sync() {
+    dwTime_t tRx;
+    uint64_t swarm = 0;
+    dwGetData(dwm, (uint8_t*) &rxFrame, NO_DATA_FRAME_SIZE + TIMESYNC_STAMP_SIZE);
+    dwGetReceiveTimestamp(dwm, &tRx);
+    memcpy(&swarm, rxFrame.data, TIMESYNC_STAMP_SIZE);
+    // the frame was sent a time of flight before it arrived
+    struct neighbour* n = neighbourTable_get(&neighbours, rxFrame.src);
+    double propTicks = (n && n->lastRangeTime) ? n->lastRange / speedOfLight * tsfreq : 0;
+    timesync_update(rxFrame.src, swarm, &tRx, propTicks, us_ticker_read());
+}
+
+// answer a single-sided poll at a fixed delay, so the tx timestamp is known in advance
+void send_ss_response() {
+    dwTime_t tPollRx;
+    dwTime_t tRespTx;
+    dwGetReceiveTimestamp(dwm, &tPollRx);
+    dwGetRawReceiveTimestamp(dwm, &tRespTx);
+    tRespTx.full = (tRespTx.full + SS_REPLY_DELAY) & 0xFFFFFFFE00;
+    txFrame.type = RANGE_SS_RESP;
+    txFrame.src = ADDR;
+    txFrame.dest = rxFrame.src;
+    txFrame.seq++;
+    memcpy(txFrame.data, tPollRx.raw, 5);
+    dwTime_t tStamp = {.full = tRespTx.full + dwm->antennaDelay.full};
+    memcpy((txFrame.data+5), tStamp.raw, 5);
+    sendDWMDelayed((uint8_t *)&txFrame, NO_DATA_FRAME_SIZE + 10, tRespTx);
+    rangingStats_sent(&rangingStats, RANGE_SS_RESP, txFrame.dest);
+}
+
+void receive_ss_response() {
+    dwTime_t tPollRx = {.full = 0};
+    dwTime_t tRespTx = {.full = 0};
+    dwTime_t tRespRx;
+    uint64_t tRound;
+    uint64_t tReply;
+    double rate;
+    dwGetData(dwm, (uint8_t*) &rxFrame, NO_DATA_FRAME_SIZE + 10);
+    dwGetReceiveTimestamp(dwm, &tRespRx);
+    memcpy(tPollRx.raw, rxFrame.data, 5);
+    memcpy(tRespTx.raw, (rxFrame.data+5), 5);
+
+    drift_update_from_timestamps(rxFrame.src, &tRespRx, &tRespTx);
+    // without drift compensation 10ppm offset at 1ms reply delay are 1.5m error
+    if(!drift_get_rate(rxFrame.src, &rate)) {
+        // the exchange itself worked, only the range can't be computed yet
+        rangingStats_done(&rangingStats, rxFrame.src, us_ticker_read());
+        if(rxFrame.src == rangingPeer)
+            rangingDone = true;
+        return;
+    }
+    calculateDeltaTime(&tStartRound1, &tRespRx, &tRound);
+    calculateDeltaTime(&tPollRx, &tRespTx, &tReply);
+    calculateSingleSidedPropagation(tRound, tReply, rate, tPropTick);
+    double range = calculateDistanceFromTicks(tPropTick);
+    float rangeRate = range_done(rxFrame.src, range);
+#if RANGE_DEBUG == 1
+    uart2.printf("%u, %u, %Lf\r\n", ADDR, rxFrame.src, range);
+#endif
+    report_range(ADDR, rxFrame.src, range, rangeQuality_score(&exchangeQuality), rangeQuality_nlos(&exchangeQuality), rangeRate);
+}
+
+// 3 frame DS-TWR (RANGING_DS3_TWR): poll, response, final. The initiator
+// schedules the final, so it carries all initiator timestamps, and the
+// responder has the range one frame after the final instead of three.
+// The responder reports it and returns it with its next response to the
+// initiator, the range frames of the 5 frame exchange are not needed.
+
+// responder, the result of the previous exchange with the initiator rides along
+void send_ds3_response() {
+    txFrame.type = RANGE_DS3_RESP;
+    txFrame.src = ADDR;
+    txFrame.dest = rxFrame.src;
+    txFrame.seq++;
+    uint8_t length = NO_DATA_FRAME_SIZE;
+    struct neighbour* n = neighbourTable_get(&neighbours, txFrame.dest);
+    if(n && n->resultPending) {
+        int32_t mm = rangeToMillimetres(n->lastRange);
+        int16_t rateMm = rangeRate_to_mm(n->rangeRate.rate);
+        memcpy(txFrame.data, &mm, sizeof(mm));
+        txFrame.data[sizeof(mm)] = n->resultQuality;
+        txFrame.data[sizeof(mm)+1] = n->resultNlos;
+        memcpy(txFrame.data+sizeof(mm)+2, &rateMm, sizeof(rateMm));
+        length += RANGE_MM_SIZE;
+        n->resultPending = 0;
+    }
+    // set once the timestamps of this response are recorded (txcallback)
+    ds3Peer = NEIGHBOUR_NONE;
+    sendDWM((uint8_t *)&txFrame, length);
+    rangingStats_sent(&rangingStats, RANGE_DS3_RESP, txFrame.dest);
+}
+
+// initiator, the final goes out at a fixed delay so its tx timestamp is known in advance
+void send_ds3_final() {
+    dwTime_t tFinalTx;
+    dwGetReceiveTimestamp(dwm, &tStartReply2);
+    dwGetRawReceiveTimestamp(dwm, &tFinalTx);
+    tFinalTx.full = (tFinalTx.full + FINAL_REPLY_DELAY) & 0xFFFFFFFE00;
+    tEndReply2.full = tFinalTx.full + dwm->antennaDelay.full;
+    uint8_t peer = rxFrame.src;
+    if(dwGetDataLength(dwm) >= NO_DATA_FRAME_SIZE + RANGE_MM_SIZE) {
+        int32_t mm;
+        int16_t rateMm;
+        dwGetData(dwm, (uint8_t*) &rxFrame, NO_DATA_FRAME_SIZE + RANGE_MM_SIZE);
+        memcpy(&mm, rxFrame.data, sizeof(mm));
+        memcpy(&rateMm, rxFrame.data+sizeof(mm)+2, sizeof(rateMm));
+        double range = rangeFromMillimetres(mm);
+        uint32_t now = us_ticker_read();
+        neighbourTable_range_received(&neighbours, peer, range, rateMm / 1000.0f, now);
+        mlat_add_range(&mlat, peer, range, now);
+        rangingStats_range(&rangingStats, peer, range, now);
+    }
+    txFrame.type = RANGE_DS3_FINAL;
+    txFrame.src = ADDR;
+    txFrame.dest = peer;
+    txFrame.seq++;
+    memcpy(txFrame.data, tStartRound1.raw, 5);
+    memcpy(txFrame.data+5, tStartReply2.raw, 5);
+    memcpy(txFrame.data+10, tEndReply2.raw, 5);
+    txFrame.data[15] = rangeQuality_score(&exchangeQuality);
+    txFrame.data[16] = rangeQuality_nlos(&exchangeQuality);
+    sendDWMDelayed((uint8_t *)&txFrame, NO_DATA_FRAME_SIZE + RANGE_FINAL_SIZE, tFinalTx);
+    rangingStats_sent(&rangingStats, RANGE_DS3_FINAL, peer);
+    // the range is computed by the peer, the exchange is done on this side
+    neighbourTable_exchange_answered(&neighbours, peer);
+    exchange_done(peer);
+}
+
+// responder, the final completes the timestamps
+void receive_ds3_final() {
+    if(rxFrame.src != ds3Peer)
+        return;
+    ds3Peer = NEIGHBOUR_NONE;
+    replyPeer = NEIGHBOUR_NONE;
+    dwTime_t tPollTx = {.full = 0};
+    dwTime_t tRespRx = {.full = 0};
+    dwTime_t tFinalTx = {.full = 0};
+    uint64_t round1, reply1, round2, reply2;
+    double propTicks;
+    if(read_frame(RANGE_FINAL_SIZE) < RANGE_TIMESTAMPS_SIZE)
+        return;
+    dwGetReceiveTimestamp(dwm, &tEndRound2);
+    memcpy(tPollTx.raw, rxFrame.data, 5);
+    memcpy(tRespRx.raw, rxFrame.data+5, 5);
+    memcpy(tFinalTx.raw, rxFrame.data+10, 5);
+    calculateDeltaTime(&tPollTx, &tRespRx, &round1);
+    calculateDeltaTime(&tStartReply1, &tEndReply1, &reply1);
+    calculateDeltaTime(&tEndReply1, &tEndRound2, &round2);
+    calculateDeltaTime(&tRespRx, &tFinalTx, &reply2);
+    calculatePropagationFormula(round1, reply1, round2, reply2, propTicks);
+    // own and remote durations swap places compared to the initiator
+    drift_update_from_exchange(rxFrame.src, reply1, round1, reply2, round2);
+    double range = calculateDistanceFromTicks(propTicks);
+    uint8_t quality = rangeQuality_score(&exchangeQuality);
+    uint8_t nlos = rangeQuality_nlos(&exchangeQuality);
+    rangeQuality_merge(&quality, &nlos, rxFrame.data[15], rxFrame.data[16]);
+    float rate = range_measured(rxFrame.src, range, &tStartReply1);
+    struct neighbour* n = neighbourTable_get(&neighbours, rxFrame.src);
+    if(n) {
+        n->resultPending = 1;
+        n->resultQuality = quality;
+        n->resultNlos = nlos;
+    }
+#if RANGE_DEBUG == 1
+    uart2.printf("%u, %u, %Lf\r\n", rxFrame.src, ADDR, range);
+#endif
+    report_range(rxFrame.src, ADDR, range, quality, nlos, rate);
+}
+
+// leader: a new round with itself and all live neighbours, in address order
+void start_snapshot() {
+    // a stalled round is ended by snapshot_watchdog
+    if(sending || snapshot.active)
+        return;
+    uint32_t now = us_ticker_read();
+    neighbourTable_expire(&neighbours, now, NEIGHBOUR_TIMEOUT_US);
+    publish_frame_limit();
+    uint8_t members[SNAPSHOT_MAX_NODES];
+    uint8_t count = 0;
+    uint8_t addr = ADDR;
+    members[count++] = ADDR;
+    for(uint8_t i = 0; i < neighbourTable_count(&neighbours) && count < SNAPSHOT_MAX_NODES; i++) {
+        addr = neighbourTable_next(&neighbours, addr);
+        members[count++] = addr;
+    }
+    if(count < 2)
+        return;
+    // the reference is the tx timestamp, see snapshot_tx
+    snapshot_start(&snapshot, ++snapshotRound, members, count, ADDR, 0, now);
+    uint8_t* payload = snapshot_header(SNAPSHOT, 0);
+    payload[0] = count;
+    memcpy(payload+1, members, count);
+    sendDWM(snapshotFrame, NO_DATA_FRAME_SIZE + SNAPSHOT_HEADER_SIZE + 1 + count);
+}
+
+// own frame in slot: a chain frame at once, a report at a fixed delay after
+// the frame received at rxTime (now if 0), so its tx timestamp is in the report
+void send_snapshot(uint8_t slot, const dwTime_t* rxTime) {
+    if(slot < snapshot.count) {
+        snapshot_header(SNAPSHOT, slot);
+        sendDWM(snapshotFrame, NO_DATA_FRAME_SIZE + SNAPSHOT_HEADER_SIZE);
+        return;
+    }
+    dwTime_t tTx;
+    if(rxTime) {
+        tTx = *rxTime;
+    } else {
+        spi.lock();
+        dwGetSystemTimestamp(dwm, &tTx);
+        spi.unlock();
+    }
+    tTx.full = (tTx.full + SNAPSHOT_REPORT_DELAY) & 0xFFFFFFFE00;
+    snapshot_tx(&snapshot, slot, (tTx.full + dwm->antennaDelay.full) & TIMESYNC_DEVICE_MASK, us_ticker_read());
+    uint8_t* payload = snapshot_header(SNAPSHOT_REPORT, slot);
+    uint8_t length = snapshot_pack(&snapshot, payload);
+    sendDWMDelayed(snapshotFrame, NO_DATA_FRAME_SIZE + SNAPSHOT_HEADER_SIZE + length, tTx);
+}
+
+// all ranges of the round to the autopilot, the own ones also as ranges
+void finish_snapshot() {
+    snapshot.active = 0;
+    uint8_t count = snapshot.count;
+    uint8_t payload[4+1+1+SNAPSHOT_MAX_NODES+1+2*SNAPSHOT_MAX_PAIRS];
+    uint32_t stamp = us_ticker_read() / 1000;
+    memcpy(payload, &stamp, 4);
+    payload[4] = snapshot.round;
+    payload[5] = count;
+    memcpy(payload+6, snapshot.members, count);
+    uint8_t* ranges = payload + 6 + count;
+    *ranges++ = count * (count - 1) / 2;
+    dwTime_t reference = {.full = snapshot.reference};
+    for(uint8_t a = 0; a < count; a++) {
+        for(uint8_t b = a + 1; b < count; b++) {
+            int16_t cm = INT16_MIN;
+            double prop = snapshot_propagation(&snapshot, a, b);
+            if(prop >= 0) {
+                double range = calculateDistanceFromTicks(prop);
+                int32_t rounded = lround(range * 100);
+                cm = rounded > INT16_MAX ? INT16_MAX : rounded <= INT16_MIN ? INT16_MIN + 1 : rounded;
+                if(a == snapshot.self)
+                    range_measured(snapshot.members[b], range, &reference);
+                else if(b == snapshot.self)
+                    range_measured(snapshot.members[a], range, &reference);
+            }
+            memcpy(ranges, &cm, sizeof(cm));
+            ranges += sizeof(cm);
+        }
+    }
+    uint8_t message[6+sizeof(payload)];
+    uint8_t l = pprz_pack(message, ADDR, PPRZ_MATRIX_MSG_ID, payload, ranges - payload);
+    sendPPRZ(message, l);
+}
+
+// SNAPSHOT or SNAPSHOT_REPORT, the next member answers at once
+void receive_snapshot() {
+    size_t length = dwGetDataLength(dwm);
+    if(length > sizeof(Buffer))
+        length = sizeof(Buffer);
+    dwGetData(dwm, Buffer, length);
+    if(length < NO_DATA_FRAME_SIZE + SNAPSHOT_HEADER_SIZE) {
+        DWMReceive();
+        return;
+    }
+    dwTime_t tRx;
+    dwGetReceiveTimestamp(dwm, &tRx);
+    uint32_t now = us_ticker_read();
+    uint8_t round = Buffer[4];
+    uint8_t slot = Buffer[5];
+    uint8_t* payload = Buffer + NO_DATA_FRAME_SIZE + SNAPSHOT_HEADER_SIZE;
+    length -= NO_DATA_FRAME_SIZE + SNAPSHOT_HEADER_SIZE;
+    if(rxFrame.type == SNAPSHOT && slot == 0 && length >= 1 && payload[0] < length) {
+        if(snapshot.active)
+            finish_snapshot();
+        snapshot_start(&snapshot, round, payload+1, payload[0], ADDR, tRx.full & TIMESYNC_DEVICE_MASK, now);
+    } else if(!snapshot.active || round != snapshot.round) {
+        DWMReceive();
+        return;
+    }
+    snapshot_rx(&snapshot, slot, tRx.full & TIMESYNC_DEVICE_MASK, now);
+    if(rxFrame.type == SNAPSHOT_REPORT)
+        snapshot_report(&snapshot, slot, payload, length);
+    if(snapshot_complete(&snapshot)) {
+        finish_snapshot();
+        DWMReceive();
+        return;
+    }
+    uint8_t next = snapshot_next(&snapshot);
+    if(next == SNAPSHOT_NO_SLOT) {
+        DWMReceive();
+        return;
+    }
+    dwTime_t tRawRx;
+    dwGetRawReceiveTimestamp(dwm, &tRawRx);
+    send_snapshot(next, &tRawRx);
 }
 
+// a member stayed silent: skip its slot, or end the round after the last one
+void snapshot_watchdog() {
+    if(!snapshot.active || sending)
+        return;
+    if(!snapshot_stalled(&snapshot, us_ticker_read(), SNAPSHOT_STALL_US)) {
+        finish_snapshot();
+        return;
+    }
+    uint8_t next = snapshot_next(&snapshot);
+    if(next != SNAPSHOT_NO_SLOT)
+        send_snapshot(next, NULL);
+}
 
-double calculate_range() {
-	dwGetData(dwm, (uint8_t*) &rxFrame, sizeof(rxFrame));
+// false if the RANGE_TRANSFER lacks timestamps, the exchange then counts as lost
+bool calculate_range(double* range) {
+	if(read_frame(RANGE_TRANSFER_SIZE) < RANGE_TIMESTAMPS_SIZE)
+		return false;
 
 	memcpy(tStartReply1.raw, rxFrame.data, 5);
 	memcpy(tEndReply1.raw, (rxFrame.data+5), 5);
@@ -204,7 +1117,9 @@ double calculate_range() {
 	calculateDeltaTime(&tEndReply1, &tEndRound2, &tRound2);
 	
 	calculatePropagationFormula(tRound1, tReply1, tRound2, tReply2, tPropTick);
-    return calculateDistanceFromTicks(tPropTick);
+	drift_update_from_exchange(rxFrame.src, tRound1, tReply1, tRound2, tReply2);
+    *range = calculateDistanceFromTicks(tPropTick);
+    return true;
 }
 
 void DWMReceive() {
@@ -212,59 +1127,218 @@ void DWMReceive() {
         return;
     dwNewReceive(dwm);
     dwStartReceive(dwm);
+#if FAST_REPLY == 1
+    // as responder the next poll is a RANGE_0 from any neighbour
+    if(!preloaded)
+        preload_reply(RANGE_1, 0);
+#endif
+}
+
+// own reply delay, from the reception of the previous frame to the transmission
+void record_turnaround(dwTime_t* rxTime, dwTime_t* txTime) {
+    uint64_t ticks;
+    calculateDeltaTime(rxTime, txTime, &ticks);
+    rangingStats_turnaround(&rangingStats, ticks / (tsfreq / 1e6));
 }
 
 void txcallback(dwDevice_t *dev){
     sending = false;
     switch(txFrame.type) {
         case RANGE_0:
+#if FAST_REPLY == 1
+            preload_reply(RANGE_2, txFrame.dest);
+#endif
+            dwGetTransmitTimestamp(dev, &tStartRound1);
+            break;
+        case RANGE_SS_POLL:
+        case RANGE_DS3_POLL:
             dwGetTransmitTimestamp(dev, &tStartRound1);
             break;
         case RANGE_1:
+        case RANGE_DS3_RESP:
             dwGetReceiveTimestamp(dev, &tStartReply1);
             dwGetTransmitTimestamp(dev, &tEndReply1);
+            record_turnaround(&tStartReply1, &tEndReply1);
+            // a final only matches the response whose timestamps are kept
+            ds3Peer = txFrame.type == RANGE_DS3_RESP ? txFrame.dest : NEIGHBOUR_NONE;
+            replyPeer = txFrame.dest;
+            replyTime = us_ticker_read();
             break;
         case RANGE_2:
             dwGetReceiveTimestamp(dev, &tStartReply2);
             dwGetTransmitTimestamp(dev, &tEndReply2);
+            record_turnaround(&tStartReply2, &tEndReply2);
             break;
+        case RANGE_DS3_FINAL:
+            record_turnaround(&tStartReply2, &tEndReply2);
+            break;
+        case SNAPSHOT:
+        case SNAPSHOT_REPORT: {
+            // a report already holds its scheduled timestamp, this restarts the stall timeout
+            dwTime_t tTx;
+            dwGetTransmitTimestamp(dev, &tTx);
+            snapshot_tx(&snapshot, snapshotTxSlot, tTx.full & TIMESYNC_DEVICE_MASK, us_ticker_read());
+            // the last report of the round was the own one
+            if(snapshot.active && snapshot_complete(&snapshot))
+                finish_snapshot();
+            break;
+                              }
+        case RANGE_SS_RESP: {
+            dwTime_t tPollRx;
+            dwTime_t tRespTx;
+            dwGetReceiveTimestamp(dev, &tPollRx);
+            dwGetTransmitTimestamp(dev, &tRespTx);
+            record_turnaround(&tPollRx, &tRespTx);
+            break;
+                            }
     }
     DWMReceive();
 }
-uint8_t Buffer[256+4];
-void handle_data_frame() {
+// the autopilots whose messages are in the DATA_FRAME payload are reached through its sender
+void learn_routes(struct circularBufferSpan span[2], size_t length) {
+    size_t i = 0;
+    while(i + 2 < length && circularBuffer_span_get(span, i) == PPRZ_STX) {
+        uint8_t l = circularBuffer_span_get(span, i + 1);
+        if(l < PPRZ_MIN_LENGTH)
+            break;
+        routingTable_learn(&routes, circularBuffer_span_get(span, i + 2), rxFrame.src);
+        i += l;
+    }
+}
+
+// version: PPRZ version of the sender's autopilot link, PPRZ_AUTO if unknown
+void handle_data_frame(uint8_t version) {
     size_t length = dwGetDataLength(dwm);
-    // cap length to buffer size
-    if(length > sizeof(Buffer)) {
-        length = sizeof(Buffer);
+    if(length > NO_DATA_FRAME_SIZE) {
+        // the payload without the 4 header bytes, read by SPI right into DWMcb
+        length -= NO_DATA_FRAME_SIZE;
+        struct circularBufferSpan span[2];
+        // a frame that doesn't fit is dropped, the main loop is behind
+        if(DWMcb.write_spans(span) >= DWM_FRAME_HEADER + length) {
+            uint8_t header[DWM_FRAME_HEADER] = {version, (uint8_t)length, (uint8_t)(length >> 8)};
+            for(uint8_t i = 0; i < DWM_FRAME_HEADER; i++) {
+                span[0].data[0] = header[i];
+                circularBuffer_span_skip(span, 1);
+            }
+            size_t first = length < span[0].length ? length : span[0].length;
+            dwSpiRead(dwm, RX_BUFFER, NO_DATA_FRAME_SIZE, span[0].data, first);
+            if(length > first)
+                dwSpiRead(dwm, RX_BUFFER, NO_DATA_FRAME_SIZE + first, span[1].data, length - first);
+            DWMcb.commit(DWM_FRAME_HEADER + length);
+            learn_routes(span, length);
+        }
     }
-    dwGetData(dwm, Buffer, length);
-    // write to the circular buffer, ignoring the 4 header bytes
-    // cap read_length to match buffer size (length - 4 may otherwise crash the buffer)
-    uint8_t read_length = length - 4;
-    circularBuffer_write(&DWMcb, Buffer+4, read_length);
     DWMReceive();
 }
 void receive_range_answer() {
     double range;
-    dwGetData(dwm, (uint8_t*) &rxFrame, NO_DATA_FRAME_SIZE + sizeof(range));
-    memcpy(&range, rxFrame.data, sizeof(range));
+    uint8_t quality;
+    uint8_t nlos;
+    int16_t rateMm;
+    if(rxFrame.type == RANGE_DATA_MM) {
+        int32_t mm;
+        if(read_frame(RANGE_MM_SIZE) < sizeof(mm))
+            return;
+        memcpy(&mm, rxFrame.data, sizeof(mm));
+        quality = rxFrame.data[sizeof(mm)];
+        nlos = rxFrame.data[sizeof(mm)+1];
+        memcpy(&rateMm, rxFrame.data+sizeof(mm)+2, sizeof(rateMm));
+        range = rangeFromMillimetres(mm);
+    } else {
+        if(read_frame(RANGE_DATA_SIZE) < sizeof(range))
+            return;
+        memcpy(&range, rxFrame.data, sizeof(range));
+        quality = rxFrame.data[sizeof(range)];
+        nlos = rxFrame.data[sizeof(range)+1];
+        memcpy(&rateMm, rxFrame.data+sizeof(range)+2, sizeof(rateMm));
+    }
+#if RANGE_DEBUG == 1
     uart2.printf("%u, %u, %Lf\r\n", rxFrame.src, rxFrame.dest, range);
-    send_pprz_range_message(rxFrame.src, rxFrame.dest, range);
+#endif
+    report_range(rxFrame.src, rxFrame.dest, range, quality, nlos, rateMm / 1000.0f);
+    if(rxFrame.dest == ADDR)
+        mlat_add_range(&mlat, rxFrame.src, range, us_ticker_read());
+}
+
+// compare with the previous range before range_done replaces it
+void check_anomaly(uint8_t addr, double range, uint8_t nlos) {
+    struct neighbour* n = neighbourTable_get(&neighbours, addr);
+    bool jump = n && n->lastRange != 0 && fabs(range - n->lastRange) > CIR_RANGE_JUMP;
+    cirAnomaly = jump || nlos >= CIR_NLOS_THRESHOLD;
+}
+
+// CIR of the frame in rxFrame. Only while the own reply is sent: the receiver
+// is off, so the accumulator still holds the frame, and the reply is not delayed
+void capture_cir() {
+#if CIR_CAPTURE == 1
+    bool anomaly = cirAnomaly;
+    cirAnomaly = false;
+    if(!sending || rxFrame.type >= DATA_FRAME)
+        return;
+    uint8_t trigger = anomaly ? CIR_TRIGGER_ANOMALY : cirTrigger_frame(&cirTrigger, rxFrame.src);
+    if(!trigger)
+        return;
+    // the debug UART is behind, drop instead of waiting
+    if(circularBuffer_capacity(&CIRcb) < CIR_RECORD_SIZE) {
+        cirSequence++;
+        return;
+    }
+    struct cirCapture capture;
+    capture.src = rxFrame.src;
+    capture.type = rxFrame.type;
+    capture.trigger = trigger;
+    capture.stamp = us_ticker_read();
+    spi.lock();
+    cir_read(dwm, &capture);
+    capture.rxPower = dwGetReceivePower(dwm);
+    capture.fpPower = dwGetFirstPathPower(dwm);
+    spi.unlock();
+    uint8_t record[CIR_RECORD_SIZE];
+    uint16_t l = cir_pack(&capture, cirSequence++, record);
+    circularBuffer_write(&CIRcb, record, l);
+#endif
+}
+
+// answer to CIR_REQ
+void request_cir(uint8_t peer, uint8_t count, uint16_t every) {
+#if CIR_CAPTURE == 1
+    cirTrigger_init(&cirTrigger, every);
+    cirTrigger_arm(&cirTrigger, peer, count);
+#else
+    (void)peer;
+    (void)count;
+    (void)every;
+#endif
 }
 
 void handle_broadcast_packet() {
     switch(rxFrame.type) {
         case DATA_FRAME:
-            handle_data_frame();
+            handle_data_frame(PPRZ_AUTO);
+            break;
+        case DATA_FRAME_V1:
+            handle_data_frame(1);
+            break;
+        case DATA_FRAME_V2:
+            handle_data_frame(2);
             break;
         case PING:
-            send_rp(PONG);
+            receive_discovery();
+            send_discovery(PONG);
             break;
         case PONG:
-            register_node();
+            // already registered in rxcallback
+            receive_discovery();
+            DWMReceive();
+            break;
+        case TIME_SYNC:
+            receive_time_sync();
             DWMReceive();
             break;
+        case SNAPSHOT:
+        case SNAPSHOT_REPORT:
+            receive_snapshot();
+            break;
         default:
             uart2.printf("unknown frame type\n\r");
             DWMReceive();
@@ -285,14 +1359,41 @@ void handle_own_packet() {
             send_range_transfer();
             break;
         case RANGE_TRANSFER: {
-            double range = calculate_range();
-            send_range(range);
+            double range;
+            if(!calculate_range(&range)) {
+                DWMReceive();
+                break;
+            }
+            uint8_t quality = rangeQuality_score(&exchangeQuality);
+            uint8_t nlos = rangeQuality_nlos(&exchangeQuality);
+            rangeQuality_merge(&quality, &nlos, rxFrame.data[15], rxFrame.data[16]);
+            check_anomaly(rxFrame.src, range, nlos);
+            float rate = range_done(rxFrame.src, range);
+            send_range(range, quality, nlos, rate);
             break;
                              }
         case RANGE_DATA:
+        case RANGE_DATA_MM:
             receive_range_answer();
             DWMReceive();
             break;
+        case RANGE_SS_POLL:
+            send_ss_response();
+            break;
+        case RANGE_SS_RESP:
+            receive_ss_response();
+            DWMReceive();
+            break;
+        case RANGE_DS3_POLL:
+            send_ds3_response();
+            break;
+        case RANGE_DS3_RESP:
+            send_ds3_final();
+            break;
+        case RANGE_DS3_FINAL:
+            receive_ds3_final();
+            DWMReceive();
+            break;
         default:
             handle_broadcast_packet();
             break;
@@ -302,6 +1403,7 @@ void handle_own_packet() {
 void handle_foreign_packet() {
     switch(rxFrame.type) {
         case RANGE_DATA:
+        case RANGE_DATA_MM:
             receive_range_answer();
             break;
         default:
@@ -310,7 +1412,10 @@ void handle_foreign_packet() {
     DWMReceive();
 }
 
+// a frame that didn't decode (collision) or an SFD timeout (a preamble without
+// frame, no frame wait timeout is set), both took airtime
 void failcallback(dwDevice_t *dev) {
+    rateControl_rx_failed(&rateControl);
     DWMReceive();
 }
 
@@ -321,10 +1426,22 @@ void rxcallback(dwDevice_t *dev)
         uart2.printf("received own packet - shouldn't happen\r\npossibly the address was given to multiple nodes\r\n\n");
         return;
     }
-    switch(rxFrame.dest) {
-        case ADDR:
+    // not a case label, ADDR may be a variable in the host simulation
+    bool own = rxFrame.dest == ADDR;
+    // the bookkeeping below would add to tReply, answer first
+    bool replied = own && fast_reply();
+    float rxPower = dwGetReceivePower(dwm);
+    register_node(rxPower);
+    rateControl_rx(&rateControl, dwGetDataLength(dwm));
+    if(own) {
+        rangingStats_received(&rangingStats, rxFrame.type, rxFrame.src);
+        record_quality(rxPower);
+        if(!replied)
             handle_own_packet();
-            break;
+        capture_cir();
+        return;
+    }
+    switch(rxFrame.dest) {
         case 0:
             handle_broadcast_packet();
             break;
@@ -338,12 +1455,162 @@ void rxcallback(dwDevice_t *dev)
     return;
 }
 
-void sendUART(uint8_t* data, int length) {
-    for(uint8_t i = 0; i<length; i++) {
-        uart1.putc(data[i]);
+#if UART_DMA_TX == 1
+// next transfer from the queue, up to the end of its array
+void uart_tx_next() {
+    const uint8_t* data;
+    uartTxLength = telemetryQueue_next(&uartTx, us_ticker_read(), &data);
+    if(uartTxLength)
+        uartDma_tx_start(data, uartTxLength);
+}
+
+// DMA interrupt: the running transfer is done
+void uart_tx_done() {
+    telemetryQueue_done(&uartTx, uartTxLength);
+    uart_tx_next();
+}
+#endif
+
+void sendUART(uint8_t* data, int length, uint8_t cls) {
+    struct circularBufferSpan span[2] = {{data, (size_t)length}, {NULL, 0}};
+    sendUARTSpans(span, length, cls);
+}
+
+// framing of the autopilot link, PPRZ_AUTO while it isn't known
+uint8_t autopilot_version() {
+    return uartParser.version;
+}
+
+// class of message m of an autopilot, by the v2 class or the id. TELEMETRY_RANGING
+// is for the own messages only (sendPPRZ), whatever ids other autopilots use
+uint8_t telemetry_class(const struct pprzMessage* m) {
+    if(m->classId == PPRZ_CLASS_DATALINK || m->classId == PPRZ_CLASS_ALERT)
+        return TELEMETRY_CONTROL;
+    for(uint8_t i = 0; i < sizeof(controlMsgIds) && controlMsgIds[i]; i++) {
+        if(m->id == controlMsgIds[i])
+            return TELEMETRY_CONTROL;
+    }
+    return TELEMETRY_BULK;
+}
+
+// own messages are packed as v1, a v2 autopilot gets them addressed to itself
+void sendPPRZ(uint8_t* message, uint8_t length) {
+    if(autopilot_version() != 2) {
+        sendUART(message, length, TELEMETRY_RANGING);
+        return;
+    }
+    uint8_t v2[255 + 2];
+    length = pprz_pack_v2(v2, message[2], ADDR, PPRZ_V2_CLASS, 0, message[3], message + 4, length - 6);
+    if(length)
+        sendUART(v2, length, TELEMETRY_RANGING);
+}
+
+// message m of another node in the framing of the autopilot link: v1 messages
+// become v2 broadcasts, v2 messages lose destination and class. Unchanged while
+// either framing isn't known
+void forward_pprz(struct circularBufferSpan span[2], const struct pprzMessage* m) {
+    uint8_t version = autopilot_version();
+    if(m->version == version || m->version == PPRZ_AUTO || version == PPRZ_AUTO) {
+        // from ring to ring without a copy in between
+        sendUARTSpans(span, m->length, telemetry_class(m));
+        return;
     }
+    uint8_t in[255];
+    uint8_t out[255 + 2];
+    circularBuffer_span_copy(span, in, m->length);
+    uint8_t payloadLength = m->length - m->payload - 2;
+    uint8_t l;
+    if(version == 2)
+        l = pprz_pack_v2(out, m->sender, PPRZ_BROADCAST, PPRZ_V2_CLASS, 0, m->id, in + m->payload, payloadLength);
+    else
+        l = pprz_pack(out, m->sender, m->id, in + m->payload, payloadLength);
+    if(l)
+        sendUART(out, l, telemetry_class(m));
 }
 
+// the first length bytes of the two pieces, as from circularBuffer_read_spans.
+// Called from the main loop and the ranging thread, cls is a telemetryClass
+void sendUARTSpans(struct circularBufferSpan span[2], size_t length, uint8_t cls) {
+    size_t first = length < span[0].length ? length : span[0].length;
+#if UART_DMA_TX == 1
+    if(uartTxDma) {
+        uint32_t now = us_ticker_read();
+        core_util_critical_section_enter();
+        if(telemetryQueue_push(&uartTx, cls, span, length, now)) {
+            size_t fill = telemetryQueue_fill(&uartTx);
+            if(fill > uartTxHighWater)
+                uartTxHighWater = fill;
+            if(!uartTxLength)
+                uart_tx_next();
+        }
+        core_util_critical_section_exit();
+        return;
+    }
+#endif
+    for(size_t i = 0; i < length; i++) {
+        uart1.putc(i < first ? span[0].data[i] : span[1].data[i - first]);
+    }
+}
+
+void update_rx_high_water() {
+    size_t fill = UARTcb.fill();
+    if(fill > uartRxHighWater)
+        uartRxHighWater = fill;
+}
+
+void print_uart_queues() {
+    uart2.printf("uart: tx queue max %u/%u, rx queue max %u/%u, %lu dropped, %lu broken messages, %lu for others, %lu oversize\r\n",
+            (unsigned)uartTxHighWater, (unsigned)UART_TX_QUEUE_SIZE, (unsigned)uartRxHighWater,
+            (unsigned)UARTcb.capacity(), (unsigned long)UARTcb.dropped(), (unsigned long)uartParser.errors,
+            (unsigned long)foreignMessages, (unsigned long)oversizeFrames);
+#if UART_DMA_TX == 1
+    static const char* classes[TELEMETRY_CLASSES] = {"control", "ranging", "bulk"};
+    for(uint8_t c = 0; c < TELEMETRY_CLASSES; c++) {
+        struct telemetryClassStats* s = &uartTx.stats[c];
+        uart2.printf("  %s: %lu sent, %lu dropped, %lu aged, latency mean %lu max %lu us\r\n", classes[c],
+                (unsigned long)s->messages, (unsigned long)s->dropped, (unsigned long)s->aged,
+                (unsigned long)(s->messages ? s->latencySum / s->messages : 0), (unsigned long)s->latencyMax);
+    }
+    core_util_critical_section_enter();
+    telemetryQueue_reset_stats(&uartTx);
+    core_util_critical_section_exit();
+#endif
+    uartTxHighWater = 0;
+    uartRxHighWater = 0;
+}
+
+#if PPRZ_PARSE_BENCH == 1
+// messages of 8..64 bytes through a ring as the UART bursts fill it
+void pprz_parse_bench() {
+    static SpscRing<2048> ring;
+    struct pprzParser parser;
+    pprzParser_init(&parser, 1);
+    uint8_t payload[58] = {0};
+    uint8_t message[64];
+    uint32_t bytes = 0;
+    uint32_t found = 0;
+    uint32_t start = us_ticker_read();
+    for(uint32_t i = 0; bytes < 1000000; i++) {
+        uint8_t l = pprz_pack(message, ADDR, i, payload, 2 + i % 57);
+        ring.write(message, l);
+        bytes += l;
+        struct circularBufferSpan span[2];
+        struct pprzMessage m;
+        while(true) {
+            ring.read_spans(span);
+            int complete = pprzParser_next(&parser, span, &m);
+            ring.consume(m.offset + m.length);
+            if(!complete)
+                break;
+            found++;
+        }
+    }
+    uint32_t us = us_ticker_read() - start;
+    uart2.printf("pprz parser: %lu bytes, %lu messages in %lu us, %lu kB/s\r\n", (unsigned long)bytes,
+            (unsigned long)found, (unsigned long)us, (unsigned long)(bytes / (us / 1000 + 1)));
+}
+#endif
+
 void serialRead() {
     // this should collect the packets to be sent, and if an packet is complets, it should be sent ... wow ...
     greenLed = 1;
@@ -352,10 +1619,23 @@ void serialRead() {
 #if ECHO == 1
         uart1.putc(c);
 #endif
-        circularBuffer_write_element(&UARTcb, c);
+        uint8_t byte = c;
+        UARTcb.write(&byte, 1);
     }
+    update_rx_high_water();
     greenLed = 0;
 }
+// DMA reception: bytes of a burst, the LED toggles per burst
+void serialBurst(const uint8_t* data, uint16_t length) {
+    greenLed = !greenLed;
+#if ECHO == 1
+    for(uint16_t i = 0; i < length; i++) {
+        uart1.putc(data[i]);
+    }
+#endif
+    UARTcb.write(data, length);
+    update_rx_high_water();
+}
 void resetRangeVariables() {
     tStartRound1.full = 0;
     tStartReply1.full = 0;
@@ -397,6 +1677,7 @@ void initialiseDWM(void) {
 
     dwNewConfiguration(dwm);
     dwSetDefaults(dwm);
+    dwUseExtendedFrameLength(dwm, EXTENDED_FRAMES == 1);
     dwEnableMode(dwm, MODE_SHORTDATA_MID_ACCURACY);
     dwSetChannel(dwm, CHANNEL_7);
     dwSetPreambleCode(dwm, PREAMBLE_CODE_64MHZ_9);
@@ -411,8 +1692,22 @@ void initialiseDWM(void) {
 }
 
 void initialiseBuffers(){
-    circularBuffer_init(&UARTcb, UARTcb_data, 256);
-    circularBuffer_init(&DWMcb, DWMcb_data, 256);
+    pprzParser_init(&uartParser, PPRZ_VERSION);
+    routingTable_init(&routes);
+    frameAggregator_init(&aggregator, aggregatorFrame, NO_DATA_FRAME_SIZE, AGGREGATE_MAX_PAYLOAD, AGGREGATE_DEADLINE_US);
+    rangeBatch_init(&rangeBatch, RANGE_BATCH_SIZE);
+    neighbourTable_init(&neighbours);
+    mlat_init(&mlat, anchorPositions, sizeof(anchorPositions) / sizeof(anchorPositions[0]));
+    rateControl_init(&rateControl, us_ticker_read());
+    rangingStats_init(&rangingStats);
+    snapshot_init(&snapshot);
+#if UART_DMA_TX == 1
+    telemetryQueue_init(&uartTx, uartTx_data, sizeof(uartTx_data), UART_TX_MAX_WAIT_US);
+#endif
+#if CIR_CAPTURE == 1
+    circularBuffer_init(&CIRcb, CIRcb_data, sizeof(CIRcb_data));
+    cirTrigger_init(&cirTrigger, CIR_EVERY_N);
+#endif
 }
 
 
@@ -433,26 +1728,99 @@ void initialiseBuffers(){
 void send_pprz_range_message(uint8_t src, uint8_t dest, double range) {
     uint8_t message[4+2+2+sizeof(range)]; 
     /* ABDE = 4; C0+C1 = 2; C2=2+sizeof(range) */
-    uint8_t idx = 0;
-    message[idx++] = 0x99; // A
-    message[idx++] = sizeof(message); // Room for B
-    message[idx++] = src; // C0
-    message[idx++] = PPRZ_MSG_ID; // C1
-    // C2 Data
-    message[idx++] = src; 
-    message[idx++] = dest;
-    memcpy(&message[idx], &range,  sizeof(range));
-    idx += sizeof(range);
-    uint8_t checksumA = 0;
-    uint8_t checksumB = 0;
-    for(uint8_t i = 1; i < idx; i++) {
-        checksumA += message[i];
-        checksumB += checksumA;
-    }
-    message[idx++] = checksumA;
-    message[idx++] = checksumB;
-
-    sendUART(message, sizeof(message));
+    uint8_t payload[2+sizeof(range)];
+    payload[0] = src; 
+    payload[1] = dest;
+    memcpy(&payload[2], &range,  sizeof(range));
+    uint8_t l = pprz_pack(message, src, PPRZ_MSG_ID, payload, sizeof(payload));
+    sendPPRZ(message, l);
+}
+
+void send_pprz_range_mm_message(uint8_t src, uint8_t dest, double range, uint8_t quality, uint8_t nlos, float rate) {
+    uint8_t message[4+2+2+RANGE_MM_SIZE];
+    uint8_t payload[2+RANGE_MM_SIZE];
+    int32_t mm = rangeToMillimetres(range);
+    payload[0] = src;
+    payload[1] = dest;
+    memcpy(&payload[2], &mm, sizeof(mm));
+    payload[2+sizeof(mm)] = quality;
+    payload[3+sizeof(mm)] = nlos;
+    int16_t rateMm = rangeRate_to_mm(rate);
+    memcpy(&payload[4+sizeof(mm)], &rateMm, sizeof(rateMm));
+    uint8_t l = pprz_pack(message, src, PPRZ_MM_MSG_ID, payload, sizeof(payload));
+    sendPPRZ(message, l);
+}
+
+// one position instead of a range per anchor on the UART
+void send_position() {
+    float position[3];
+    float rms;
+    uint8_t anchors = mlat_solve(&mlat, us_ticker_read(), POSITION_MAX_AGE_US, position, &rms);
+    if(!anchors)
+        return;
+    uint8_t payload[4*sizeof(float)+1];
+    memcpy(payload, position, sizeof(position));
+    memcpy(payload+sizeof(position), &rms, sizeof(rms));
+    payload[sizeof(payload)-1] = anchors;
+    uint8_t message[6+sizeof(payload)];
+    uint8_t l = pprz_pack(message, ADDR, PPRZ_POSITION_MSG_ID, payload, sizeof(payload));
+    sendPPRZ(message, l);
+}
+
+void flush_range_batch() {
+    if(rangeBatch_count(&rangeBatch) == 0)
+        return;
+    uint8_t message[256];
+    uint8_t l = rangeBatch_pack(&rangeBatch, ADDR, PPRZ_BATCH_MSG_ID, message);
+    sendPPRZ(message, l);
+}
+
+// collect ranges into RANGE_BATCH reports, header and checksum are shared by the batch
+void report_range(uint8_t src, uint8_t dest, double range, uint8_t quality, uint8_t nlos, float rate) {
+#if RANGE_BATCH_SIZE > 0
+    if(rangeBatch_add(&rangeBatch, us_ticker_read() / 1000, src, dest, range, quality, nlos, rangeRate_to_mm(rate)))
+        flush_range_batch();
+#elif COMPACT_RANGE == 1
+    send_pprz_range_mm_message(src, dest, range, quality, nlos, rate);
+#else
+    // the legacy RANGE message has no room for the rating and the rate
+    send_pprz_range_message(src, dest, range);
+#endif
+}
+
+// compact binary snapshot of the ranging statistics, answer to RANGING_STATS_REQ
+void send_ranging_stats(bool reset) {
+    uint8_t payload[RANGING_STATS_SNAPSHOT_SIZE];
+    uint8_t length = rangingStats_pack(&rangingStats, us_ticker_read() / 1000, payload);
+    uint8_t message[6+sizeof(payload)];
+    uint8_t l = pprz_pack(message, ADDR, PPRZ_STATS_MSG_ID, payload, length);
+    sendPPRZ(message, l);
+    if(reset)
+        rangingStats_init(&rangingStats);
+}
+
+void send_swarm_time() {
+    uint32_t now = us_ticker_read();
+    dwTime_t tNow;
+    uint64_t swarm;
+    spi.lock();
+    dwGetSystemTimestamp(dwm, &tNow);
+    spi.unlock();
+    if(!timesync_synced(now) || !timesync_to_swarm(&tNow, &swarm))
+        return;
+    uint32_t swarmUs = (uint64_t)(swarm / (tsfreq / 1e6));
+    float skew = timesync_skew() * 1e6;
+    uint32_t age = timesync_age(now) / 1000;
+    uint16_t syncAge = age > 0xFFFF ? 0xFFFF : age;
+    uint8_t payload[4+4+4+1+2];
+    memcpy(payload, &swarmUs, 4);
+    memcpy(payload+4, &now, 4);
+    memcpy(payload+8, &skew, 4);
+    payload[12] = timesync_reference();
+    memcpy(payload+13, &syncAge, 2);
+    uint8_t message[6+sizeof(payload)];
+    uint8_t l = pprz_pack(message, ADDR, PPRZ_SWARM_TIME_MSG_ID, payload, sizeof(payload));
+    sendPPRZ(message, l);
 }
 
 void irq_cheker() {
@@ -470,45 +1838,228 @@ void irq_cheker() {
     DWMReceive();
 }
 
-int main() {
+uint8_t WriteBuffer[256+4];
+
+// ranging thread: a pending DATA_FRAME goes out unless a transmission or an
+// exchange is in progress, then it is tried again every ms
+void transmit_aggregate() {
+    if(!aggregatePending || sending || !rangingDone || snapshot.active)
+        return;
+    // as responder, a lost frame of the initiator ends the exchange after a slot
+    if(replyPeer != NEIGHBOUR_NONE && us_ticker_read() - replyTime < RANGE_INTERVALL_US)
+        return;
+    // txcallback takes the timestamps by txFrame.type, none for a DATA_FRAME
+    txFrame.type = aggregatorFrame[2];
+    aggregatorFrame[3] = txFrame.seq++;
+    sendDWM(aggregatorFrame, aggregatePending);
+    aggregatePending = 0;
+}
+
+// UWB address for message m of the autopilot, 0 broadcasts it
+uint8_t route_message(const struct pprzMessage* m) {
+#if UNICAST_ROUTING == 1
+    if(m->version != 2 || m->dest == PPRZ_BROADCAST)
+        return 0;
+    uint8_t addr = routingTable_lookup(&routes, m->dest);
+    // not heard from yet, the node with the same address (ADDR == AC_ID)
+    if(addr == ROUTE_NONE)
+        addr = m->dest;
+    // a node that isn't discovered yet still gets a broadcast
+    return neighbourTable_contains(&neighbours, addr) ? addr : 0;
+#else
+    return 0;
+#endif
+}
+
+// DATA_FRAME payload that dest (0 all neighbours) receives
+uint16_t aggregate_capacity(uint8_t dest) {
+    uint16_t limit = broadcastFrameLimit;
+    if(dest != 0) {
+        // one entry, it must not move while it is read
+        core_util_critical_section_enter();
+        limit = neighbourTable_frame_limit(&neighbours, dest);
+        core_util_critical_section_exit();
+    }
+    return (limit < MAX_FRAME ? limit : MAX_FRAME) - 2 - NO_DATA_FRAME_SIZE;
+}
+
+// the aggregated PPRZ messages as DATA_FRAME to aggregateDest, sent by the
+// ranging thread between its own frames
+void send_aggregate() {
+    uint16_t l = frameAggregator_take(&aggregator);
+    if(!l)
+        return;
+    aggregatorFrame[0] = ADDR;
+    aggregatorFrame[1] = aggregateDest;
+    // the receivers parse the frame with the version of the own autopilot link
+    if(aggregateVersion == 1)
+        aggregatorFrame[2] = DATA_FRAME_V1;
+    else if(aggregateVersion == 2)
+        aggregatorFrame[2] = DATA_FRAME_V2;
+    else
+        aggregatorFrame[2] = DATA_FRAME;
+    aggregatePending = l;
+    IRQqueue.call(transmit_aggregate);
+}
+
+void setup() {
     initialiseBuffers();
+    drift_init();
+    timesync_init(TIMESYNC_REFERENCE, ADDR);
     t_irq.start(callback(&IRQqueue, &EventQueue::dispatch_forever));
     t_irq.set_priority(osPriorityHigh);
     sIRQ.mode(PullDown);
     sIRQ.rise(IRQqueue.event(&dwIRQFunction));
     initialiseDWM();
     uart2.printf("Start Ranging\n");
+#if PPRZ_PARSE_BENCH == 1
+    pprz_parse_bench();
+#endif
+#if CIR_CAPTURE == 1
+    uart2.baud(CIR_BAUD);
+#endif
     uart1.baud(TELEMETRY_BAUD);
     uart1.format( 	8, SerialBase::None, 1 ); // 8bits, no parity, 1stop-bit
-    uart1.attach(&serialRead,Serial::RxIrq);
+#if UART_DMA_RX == 1
+    if(!uartDma_rx_start(TELEMETRY_RX, uartDmaRx_data, sizeof(uartDmaRx_data), serialBurst))
+#endif
+        uart1.attach(&serialRead,Serial::RxIrq);
+#if UART_DMA_TX == 1
+    uartTxDma = uartDma_tx_init(TELEMETRY_TX, uart_tx_done);
+#endif
 
-    uint8_t WriteBuffer[256+4];
-#if ADDR != 1
-    IRQqueue.call_every(RANGE_INTERVALL_US, startRanging);
+    if(ADDR != 1)
+        IRQqueue.call_every(RANGE_INTERVALL_US / 1000, startRanging); // call_every takes ms
+    else
+        IRQqueue.call_every(RANGE_INTERVALL_US / 1000, announce_frame_limit);
+#if RANGING_MODE == RANGING_SNAPSHOT
+    if(ADDR == SNAPSHOT_LEADER)
+        IRQqueue.call_every(SNAPSHOT_INTERVALL_MS, start_snapshot);
+    IRQqueue.call_every(1, snapshot_watchdog);
 #endif
     IRQqueue.call_every(IRQ_CHECKER_INTERVALL, irq_cheker);
-    while (true){
-        /*
-        if(dwm->deviceMode == IDLE_MODE) {
-            sending = false;
-            DWMReceive();
+    IRQqueue.call_every(1, transmit_aggregate);
+    IRQqueue.call_every(RATE_UPDATE_MS, update_ranging_rate);
+    if(ADDR == TIMESYNC_REFERENCE)
+        IRQqueue.call_every(TIMESYNC_INTERVALL_MS, send_time_sync);
+    IRQqueue.call_every(SWARM_TIME_INTERVALL_MS, send_swarm_time);
+#if RATE_DEBUG == 1
+    IRQqueue.call_every(RATE_DEBUG_MS, print_ranging_rate);
+#endif
+#if UART_DEBUG == 1
+    IRQqueue.call_every(UART_DEBUG_MS, print_uart_queues);
+#endif
+#if RANGE_BATCH_SIZE > 0
+    // same thread as the ranging callbacks, no locking of rangeBatch needed
+    IRQqueue.call_every(RANGE_BATCH_FLUSH_MS, flush_range_batch);
+#endif
+#if POSITION_SOLVER == 1
+    IRQqueue.call_every(POSITION_INTERVALL_MS, send_position);
+#endif
+}
+
+// one spin of the main loop, the host simulator (sim/) calls it directly
+void loop() {
+    /*
+    if(dwm->deviceMode == IDLE_MODE) {
+        sending = false;
+        DWMReceive();
+    }
+    */
+    uint32_t now = us_ticker_read();
+    struct circularBufferSpan span[2];
+    struct pprzMessage m;
+    while(true) {
+        UARTcb.read_spans(span);
+        if(!pprzParser_next(&uartParser, span, &m)) {
+            UARTcb.consume(m.offset);
+            break;
         }
-        */
-        uint8_t l = parsePPRZ(&UARTcb);
-        if(l){
-            WriteBuffer[0] = ADDR;
-            WriteBuffer[1] = 0; // Broacast
-            WriteBuffer[2] = DATA_FRAME;
-            WriteBuffer[3] = txFrame.seq++;
-            circularBuffer_read(&UARTcb, WriteBuffer+4, l);
-            sendDWM(WriteBuffer, l+4);
+        circularBuffer_span_skip(span, m.offset);
+        uint8_t l = m.length;
+        uint8_t dest = route_message(&m);
+        if(m.id == PPRZ_STATS_REQ_MSG_ID) {
+            // addressed to this node, not forwarded
+            circularBuffer_span_copy(span, WriteBuffer, l);
+            // the statistics belong to the ranging thread
+            IRQqueue.call(send_ranging_stats, l > m.payload + 2 && WriteBuffer[m.payload] != 0);
+        } else if(m.id == PPRZ_CIR_REQ_MSG_ID) {
+            circularBuffer_span_copy(span, WriteBuffer, l);
+            uint8_t* payload = WriteBuffer + m.payload;
+            if(l >= m.payload + 6)
+                IRQqueue.call(request_cir, payload[0], payload[1], (uint16_t)(payload[2] | payload[3] << 8));
+        } else if(l > aggregate_capacity(dest)) {
+            // doesn't fit into a frame its receivers take
+            core_util_atomic_incr_u32(&oversizeFrames, 1);
+        } else {
+            bool full = aggregator.length && (dest != aggregateDest || m.version != aggregateVersion
+                    || !frameAggregator_fits(&aggregator, l));
+            // a frame now would abort the scheduled report of a snapshot round
+            if(full && !snapshot.active)
+                send_aggregate();
+            // the message waits in UARTcb until aggregatorFrame is free
+            if(aggregatePending || (full && snapshot.active)) {
+                UARTcb.consume(m.offset);
+                pprzParser_restart(&uartParser);
+                break;
+            }
+            // takes effect at once for an empty aggregator
+            frameAggregator_set_capacity(&aggregator, aggregate_capacity(dest));
+            aggregateDest = dest;
+            aggregateVersion = m.version;
+            bool control = telemetry_class(&m) == TELEMETRY_CONTROL;
+            circularBuffer_span_copy(span, frameAggregator_add(&aggregator, l, control, now), l);
         }
-        Thread::yield();
-        l = parsePPRZ(&DWMcb);
-        if(l){
-            circularBuffer_read(&DWMcb, WriteBuffer, l);
-            sendUART(WriteBuffer, l);
+        UARTcb.consume(m.offset + l);
+    }
+    if(!snapshot.active && frameAggregator_due(&aggregator, now))
+        send_aggregate();
+    Thread::yield();
+    // all messages into the queues of their class, the UART takes them by priority
+    while(true) {
+        if(!dwmFrameLeft) {
+            // frames are committed as a whole, with the header the payload is there
+            if(DWMcb.fill() < DWM_FRAME_HEADER)
+                break;
+            uint8_t header[DWM_FRAME_HEADER];
+            DWMcb.read(header, DWM_FRAME_HEADER);
+            pprzParser_init(&dwmParser, header[0]);
+            dwmFrameLeft = header[1] | header[2] << 8;
+            continue;
         }
-        Thread::yield();
+        DWMcb.read_spans(span);
+        circularBuffer_span_limit(span, dwmFrameLeft);
+        if(!pprzParser_next(&dwmParser, span, &m)) {
+            // no complete message in the rest of the frame
+            DWMcb.consume(dwmFrameLeft);
+            dwmFrameLeft = 0;
+            continue;
+        }
+        circularBuffer_span_skip(span, m.offset);
+#if UNICAST_ROUTING == 1
+        // broadcast for want of a route, or sent before the routes were known
+        if(m.version == 2 && m.dest != PPRZ_BROADCAST && m.dest != ADDR)
+            foreignMessages++;
+        else
+#endif
+            forward_pprz(span, &m);
+        DWMcb.consume(m.offset + m.length);
+        dwmFrameLeft -= m.offset + m.length;
+    }
+#if CIR_CAPTURE == 1
+    // only what the UART takes without blocking, the rest on the next spin
+    while(circularBuffer_fill(&CIRcb) && uart2.writeable()) {
+        uart2.putc(circularBuffer_read_element(&CIRcb));
+    }
+#endif
+    Thread::yield();
+}
+
+#ifndef SIMULATION
+int main() {
+    setup();
+    while (true){
+        loop();
     }
 }
+#endif
@@ -0,0 +1,116 @@
+#include "multilateration.h"
+#include "math.h"
+
+void mlat_init(struct mlat* m, const struct mlatAnchor* anchors, uint8_t anchorCount) {
+    if(anchorCount > MLAT_MAX_ANCHORS)
+        anchorCount = MLAT_MAX_ANCHORS;
+    m->anchors = anchors;
+    m->anchorCount = anchorCount;
+    m->hasPosition = 0;
+    for(uint8_t i = 0; i < MLAT_MAX_ANCHORS; i++) {
+        m->valid[i] = 0;
+    }
+}
+
+void mlat_add_range(struct mlat* m, uint8_t addr, float range, uint32_t now) {
+    for(uint8_t i = 0; i < m->anchorCount; i++) {
+        if(m->anchors[i].addr == addr) {
+            m->range[i] = range;
+            m->stamp[i] = now;
+            m->valid[i] = 1;
+            return;
+        }
+    }
+}
+
+// solve the symmetric 3x3 system A x = b with Cramer's rule, returns 0 if singular
+static int solve3(const float A[3][3], const float b[3], float x[3]) {
+    float c0 = A[1][1] * A[2][2] - A[1][2] * A[2][1];
+    float c1 = A[1][0] * A[2][2] - A[1][2] * A[2][0];
+    float c2 = A[1][0] * A[2][1] - A[1][1] * A[2][0];
+    float det = A[0][0] * c0 - A[0][1] * c1 + A[0][2] * c2;
+    if(fabsf(det) < 1e-9f)
+        return 0;
+    float inv = 1.0f / det;
+    x[0] = (b[0] * c0
+            - A[0][1] * (b[1] * A[2][2] - A[1][2] * b[2])
+            + A[0][2] * (b[1] * A[2][1] - A[1][1] * b[2])) * inv;
+    x[1] = (A[0][0] * (b[1] * A[2][2] - A[1][2] * b[2])
+            - b[0] * c1
+            + A[0][2] * (A[1][0] * b[2] - b[1] * A[2][0])) * inv;
+    x[2] = (A[0][0] * (A[1][1] * b[2] - b[1] * A[2][1])
+            - A[0][1] * (A[1][0] * b[2] - b[1] * A[2][0])
+            + b[0] * c2) * inv;
+    return 1;
+}
+
+uint8_t mlat_solve(struct mlat* m, uint32_t now, uint32_t maxAge, float position[3], float* rms) {
+    uint8_t used[MLAT_MAX_ANCHORS];
+    uint8_t n = 0;
+    for(uint8_t i = 0; i < m->anchorCount; i++) {
+        if(m->valid[i] && now - m->stamp[i] <= maxAge)
+            used[n++] = i;
+    }
+    // x, y and z need at least 4 anchors
+    if(n < 4)
+        return 0;
+
+    float p[3];
+    if(m->hasPosition) {
+        p[0] = m->position[0];
+        p[1] = m->position[1];
+        p[2] = m->position[2];
+    } else {
+        // centroid of the anchors, slightly off to avoid a symmetric start
+        p[0] = p[1] = p[2] = 0;
+        for(uint8_t k = 0; k < n; k++) {
+            p[0] += m->anchors[used[k]].x;
+            p[1] += m->anchors[used[k]].y;
+            p[2] += m->anchors[used[k]].z;
+        }
+        p[0] = p[0] / n + 0.1f;
+        p[1] = p[1] / n + 0.1f;
+        p[2] = p[2] / n + 0.1f;
+    }
+
+    float sumSquares = 0;
+    for(uint8_t it = 0; it < MLAT_MAX_ITERATIONS; it++) {
+        // normal equations J^T J dx = -J^T r of the range residuals
+        float JtJ[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+        float Jtr[3] = {0, 0, 0};
+        sumSquares = 0;
+        for(uint8_t k = 0; k < n; k++) {
+            const struct mlatAnchor* a = &m->anchors[used[k]];
+            float d[3] = {p[0] - a->x, p[1] - a->y, p[2] - a->z};
+            float dist = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+            if(dist < 1e-3f)
+                dist = 1e-3f;
+            float r = dist - m->range[used[k]];
+            sumSquares += r * r;
+            for(uint8_t i = 0; i < 3; i++) {
+                float ji = d[i] / dist;
+                Jtr[i] -= ji * r;
+                for(uint8_t j = 0; j < 3; j++) {
+                    JtJ[i][j] += ji * d[j] / dist;
+                }
+            }
+        }
+        float dx[3];
+        if(!solve3(JtJ, Jtr, dx))
+            return 0;
+        p[0] += dx[0];
+        p[1] += dx[1];
+        p[2] += dx[2];
+        if(fabsf(dx[0]) + fabsf(dx[1]) + fabsf(dx[2]) < MLAT_CONVERGED)
+            break;
+    }
+    if(!isfinite(p[0]) || !isfinite(p[1]) || !isfinite(p[2]))
+        return 0;
+
+    m->position[0] = position[0] = p[0];
+    m->position[1] = position[1] = p[1];
+    m->position[2] = position[2] = p[2];
+    m->hasPosition = 1;
+    *rms = sqrtf(sumSquares / n);
+    return n;
+}
@@ -0,0 +1,38 @@
+#ifndef __multilateration_h
+#define __multilateration_h
+
+#include "inttypes.h"
+#include "stddef.h"
+
+// anchors considered by the solver
+#define MLAT_MAX_ANCHORS 8
+#define MLAT_MAX_ITERATIONS 10
+// stop iterating once the position update is smaller (m)
+#define MLAT_CONVERGED 0.001f
+
+struct mlatAnchor {
+    uint8_t addr;
+    float x;
+    float y;
+    float z;
+};
+
+struct mlat {
+    const struct mlatAnchor* anchors;
+    uint8_t anchorCount;
+    float range[MLAT_MAX_ANCHORS];
+    uint32_t stamp[MLAT_MAX_ANCHORS];
+    uint8_t valid[MLAT_MAX_ANCHORS];
+    // last solution, start point of the next solve
+    float position[3];
+    uint8_t hasPosition;
+};
+
+void mlat_init(struct mlat* m, const struct mlatAnchor* anchors, uint8_t anchorCount);
+// store a range to addr, ranges to nodes that are no anchor are ignored
+void mlat_add_range(struct mlat* m, uint8_t addr, float range, uint32_t now);
+// Gauss-Newton least squares over all ranges younger than maxAge,
+// returns the number of anchors used or 0 if no position could be found
+uint8_t mlat_solve(struct mlat* m, uint32_t now, uint32_t maxAge, float position[3], float* rms);
+
+#endif // include guard
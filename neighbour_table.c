@@ -0,0 +1,168 @@
+#include "neighbour_table.h"
+
+static void set_present(struct neighbourTable* nt, uint8_t addr, int present) {
+    if(present)
+        nt->present[addr >> 5] |= (uint32_t)1 << (addr & 31);
+    else
+        nt->present[addr >> 5] &= ~((uint32_t)1 << (addr & 31));
+}
+
+void neighbourTable_init(struct neighbourTable* nt) {
+    for(uint8_t i = 0; i < 8; i++) {
+        nt->present[i] = 0;
+    }
+    nt->count = 0;
+}
+
+int neighbourTable_contains(struct neighbourTable* nt, uint8_t addr) {
+    return (nt->present[addr >> 5] >> (addr & 31)) & 1;
+}
+
+struct neighbour* neighbourTable_get(struct neighbourTable* nt, uint8_t addr) {
+    if(!neighbourTable_contains(nt, addr))
+        return 0;
+    return &nt->entries[nt->slot[addr]];
+}
+
+struct neighbour* neighbourTable_seen(struct neighbourTable* nt, uint8_t addr, uint32_t now, float rxPower) {
+    struct neighbour* n = neighbourTable_get(nt, addr);
+    if(!n) {
+        if(nt->count >= NEIGHBOUR_TABLE_SIZE)
+            return 0;
+        nt->slot[addr] = nt->count;
+        n = &nt->entries[nt->count++];
+        set_present(nt, addr, 1);
+        n->addr = addr;
+        n->failures = 0;
+        n->lossRate = 0;
+        n->lastRange = 0;
+        n->lastRangeTime = 0;
+        rangeRate_reset(&n->rangeRate);
+        n->resultPending = 0;
+        n->maxFrame = NEIGHBOUR_STANDARD_FRAME;
+        n->nextPoll = now;
+    }
+    n->lastSeen = now;
+    n->rxPower = rxPower;
+    return n;
+}
+
+void neighbourTable_remove(struct neighbourTable* nt, uint8_t addr) {
+    if(!neighbourTable_contains(nt, addr))
+        return;
+    uint8_t index = nt->slot[addr];
+    uint8_t last = --nt->count;
+    // keep the entries dense by moving the last one into the gap
+    if(index != last) {
+        nt->entries[index] = nt->entries[last];
+        nt->slot[nt->entries[index].addr] = index;
+    }
+    set_present(nt, addr, 0);
+}
+
+uint8_t neighbourTable_expire(struct neighbourTable* nt, uint32_t now, uint32_t timeout) {
+    uint8_t removed = 0;
+    uint8_t i = 0;
+    while(i < nt->count) {
+        if(now - nt->entries[i].lastSeen > timeout) {
+            neighbourTable_remove(nt, nt->entries[i].addr);
+            removed++;
+        } else {
+            i++;
+        }
+    }
+    return removed;
+}
+
+void neighbourTable_exchange_failed(struct neighbourTable* nt, uint8_t addr) {
+    struct neighbour* n = neighbourTable_get(nt, addr);
+    if(!n)
+        return;
+    n->lossRate += NEIGHBOUR_LOSS_GAIN * (1.0f - n->lossRate);
+    if(n->failures < 255)
+        n->failures++;
+}
+
+void neighbourTable_exchange_answered(struct neighbourTable* nt, uint8_t addr) {
+    struct neighbour* n = neighbourTable_get(nt, addr);
+    if(!n)
+        return;
+    n->lossRate -= NEIGHBOUR_LOSS_GAIN * n->lossRate;
+    n->failures = 0;
+}
+
+void neighbourTable_range_received(struct neighbourTable* nt, uint8_t addr, float range, float rate, uint32_t now) {
+    struct neighbour* n = neighbourTable_get(nt, addr);
+    if(!n)
+        return;
+    n->lastRange = range;
+    n->lastRangeTime = now;
+    n->rangeRate.rate = rate;
+}
+
+void neighbourTable_exchange_done(struct neighbourTable* nt, uint8_t addr, float range, uint64_t stamp, uint32_t now) {
+    struct neighbour* n = neighbourTable_get(nt, addr);
+    if(!n)
+        return;
+    neighbourTable_exchange_answered(nt, addr);
+    rangeRate_add(&n->rangeRate, stamp, range);
+    n->lastRange = range;
+    n->lastRangeTime = now;
+}
+
+void neighbourTable_set_max_frame(struct neighbourTable* nt, uint8_t addr, uint16_t maxFrame) {
+    struct neighbour* n = neighbourTable_get(nt, addr);
+    if(n)
+        n->maxFrame = maxFrame;
+}
+
+uint16_t neighbourTable_frame_limit(struct neighbourTable* nt, uint8_t addr) {
+    if(addr != 0) {
+        struct neighbour* n = neighbourTable_get(nt, addr);
+        return n ? n->maxFrame : NEIGHBOUR_STANDARD_FRAME;
+    }
+    if(nt->count == 0)
+        return NEIGHBOUR_STANDARD_FRAME;
+    uint16_t limit = nt->entries[0].maxFrame;
+    for(uint8_t i = 1; i < nt->count; i++) {
+        if(nt->entries[i].maxFrame < limit)
+            limit = nt->entries[i].maxFrame;
+    }
+    return limit;
+}
+
+float neighbourTable_loss(struct neighbourTable* nt) {
+    if(nt->count == 0)
+        return 0;
+    float sum = 0;
+    for(uint8_t i = 0; i < nt->count; i++) {
+        sum += nt->entries[i].lossRate;
+    }
+    return sum / nt->count;
+}
+
+uint8_t neighbourTable_count(struct neighbourTable* nt) {
+    return nt->count;
+}
+
+struct neighbour* neighbourTable_at(struct neighbourTable* nt, uint8_t index) {
+    if(index >= nt->count)
+        return 0;
+    return &nt->entries[index];
+}
+
+uint8_t neighbourTable_next(struct neighbourTable* nt, uint8_t addr) {
+    if(nt->count == 0)
+        return NEIGHBOUR_NONE;
+    uint8_t a = addr + 1;
+    uint8_t w = a >> 5;
+    uint32_t word = nt->present[w] & (~(uint32_t)0 << (a & 31));
+    // 9 words: the rest of the first one, the others, and the first one again (wrap)
+    for(uint8_t i = 0; i < 9; i++) {
+        if(word)
+            return (w << 5) + __builtin_ctz(word);
+        w = (w + 1) & 7;
+        word = nt->present[w];
+    }
+    return NEIGHBOUR_NONE;
+}
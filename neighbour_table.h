@@ -0,0 +1,71 @@
+#ifndef __neighbour_table_h
+#define __neighbour_table_h
+
+#include "inttypes.h"
+#include "stddef.h"
+#include "range_rate.h"
+
+// maximum number of neighbours with a record at the same time
+#define NEIGHBOUR_TABLE_SIZE 32
+#define NEIGHBOUR_NONE 0xFF
+// weight of a new exchange in the loss rate filter
+#define NEIGHBOUR_LOSS_GAIN 0.125f
+// longest frame (bytes with FCS) of a neighbour that didn't announce more
+#define NEIGHBOUR_STANDARD_FRAME 127
+
+struct neighbour {
+    uint8_t addr;
+    uint8_t failures;       // consecutive failed exchanges
+    uint32_t lastSeen;      // us
+    float rxPower;          // dBm of the last frame received from addr
+    float lossRate;         // filtered ratio of failed exchanges
+    float lastRange;        // m
+    uint32_t lastRangeTime; // us
+    struct rangeRate rangeRate;
+    uint32_t nextPoll;      // us, set by the ranging scheduler
+    // range computed as responder of a 3 frame exchange, not yet sent back
+    uint8_t resultPending;
+    uint8_t resultQuality;
+    uint8_t resultNlos;
+    uint16_t maxFrame;      // longest frame addr receives, announced in PING/PONG
+};
+
+struct neighbourTable {
+    uint32_t present[8];    // bitset over all 256 addresses
+    uint8_t slot[256];      // addr -> index into entries, valid if present
+    struct neighbour entries[NEIGHBOUR_TABLE_SIZE];
+    uint8_t count;
+};
+
+void neighbourTable_init(struct neighbourTable* nt);
+
+int neighbourTable_contains(struct neighbourTable* nt, uint8_t addr);
+// O(1) lookup, returns 0 if addr is unknown
+struct neighbour* neighbourTable_get(struct neighbourTable* nt, uint8_t addr);
+// create or refresh the record of addr, returns 0 if the table is full
+struct neighbour* neighbourTable_seen(struct neighbourTable* nt, uint8_t addr, uint32_t now, float rxPower);
+void neighbourTable_remove(struct neighbourTable* nt, uint8_t addr);
+// remove all neighbours not seen for longer than timeout, returns the number removed
+uint8_t neighbourTable_expire(struct neighbourTable* nt, uint32_t now, uint32_t timeout);
+
+void neighbourTable_exchange_failed(struct neighbourTable* nt, uint8_t addr);
+// the peer answered, for exchanges whose range is computed by the peer
+void neighbourTable_exchange_answered(struct neighbourTable* nt, uint8_t addr);
+// range and rate computed by addr, they replace the own estimate
+void neighbourTable_range_received(struct neighbourTable* nt, uint8_t addr, float range, float rate, uint32_t now);
+// stamp: device time at the start of the exchange, for the range rate
+void neighbourTable_exchange_done(struct neighbourTable* nt, uint8_t addr, float range, uint64_t stamp, uint32_t now);
+
+void neighbourTable_set_max_frame(struct neighbourTable* nt, uint8_t addr, uint16_t maxFrame);
+// longest frame addr receives, for a broadcast (addr 0) the longest all neighbours receive
+uint16_t neighbourTable_frame_limit(struct neighbourTable* nt, uint8_t addr);
+// mean exchange loss rate of all neighbours, 0 without any
+float neighbourTable_loss(struct neighbourTable* nt);
+
+// iteration: entries 0..count-1 are dense, order changes on removal
+uint8_t neighbourTable_count(struct neighbourTable* nt);
+struct neighbour* neighbourTable_at(struct neighbourTable* nt, uint8_t index);
+// next known address after addr in ascending order (wrapping), NEIGHBOUR_NONE if the table is empty
+uint8_t neighbourTable_next(struct neighbourTable* nt, uint8_t addr);
+
+#endif // include guard
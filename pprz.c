@@ -1,50 +1,190 @@
 #include "pprz.h"
 #include "circular_buffer.h"
+#include "string.h"
 
-enum PPRZ_STATUS check_pprz(struct circularBuffer* cb) {
-    size_t fill = circularBuffer_fill(cb);
-    if(fill < 5)
-        // buffer not full enough for whole package
-        return PPRZ_SHORT;
-    if(circularBuffer_peek(cb, 0) != 0x99)
-        // no startbyte
-        return PPRZ_BROKEN;
-    uint8_t l = circularBuffer_peek(cb, 1);
-    if(l > fill)
-        // Buffer does not contain the hole package yet
-        return PPRZ_SHORT;
-    if(l <= 4) {
-        // dismiss packet if length < HEADER + PAYLOAD
-        return PPRZ_BROKEN;
+enum pprzParserState {
+    PPRZ_WAIT_STX,
+    PPRZ_LENGTH,
+    PPRZ_BODY
+};
+
+void pprzParser_init(struct pprzParser* p, uint8_t version) {
+    pprzParser_restart(p);
+    p->version = version;
+    p->v2Messages = 0;
+    p->errors = 0;
+}
+
+void pprzParser_restart(struct pprzParser* p) {
+    p->state = PPRZ_WAIT_STX;
+    p->start = 0;
+    p->scanned = 0;
+}
+
+// PPRZ has no byte stuffing, the STX of a broken message may have been a
+// payload byte. The search goes on right after it, so a message behind it is
+// found even if the broken one claimed its bytes
+static void pprz_resync(struct pprzParser* p) {
+    p->errors++;
+    p->state = PPRZ_WAIT_STX;
+    p->scanned = p->start + 1;
+}
+
+// byte c at offset i, 1 when it completes a valid message
+static int pprz_step(struct pprzParser* p, uint8_t c, size_t i) {
+    switch(p->state) {
+        case PPRZ_WAIT_STX:
+            if(c == PPRZ_STX) {
+                p->start = i;
+                p->state = PPRZ_LENGTH;
+            }
+            return 0;
+        case PPRZ_LENGTH:
+            if(c < (p->version == 2 ? PPRZ_V2_MIN_LENGTH : PPRZ_MIN_LENGTH)) {
+                pprz_resync(p);
+                return 0;
+            }
+            p->length = c;
+            p->count = 2;
+            p->checksumA = c;
+            p->checksumB = c;
+            p->state = PPRZ_BODY;
+            return 0;
     }
-    uint8_t checksumA = 0;
-    uint8_t checksumB = 0;
-    for(size_t i = 1; i<l-2; i++) {
-        checksumA += circularBuffer_peek(cb, i);
-        checksumB += checksumA;
+    p->count++;
+    if(p->count <= p->length - 2) {
+        if(p->count <= 6)
+            p->header[p->count - 3] = c;
+        p->checksumA += c;
+        p->checksumB += p->checksumA;
+        return 0;
+    }
+    if(p->count == p->length - 1) {
+        if(c == p->checksumA)
+            return 0;
+    } else if(c == p->checksumB) {
+        p->state = PPRZ_WAIT_STX;
+        return 1;
     }
-    if(checksumA != circularBuffer_peek(cb, l-2)) {
-        return PPRZ_BROKEN;
+    pprz_resync(p);
+    return 0;
+}
+
+// a v1 message could be v2 if it is long enough and the class is a known one
+static int pprz_v2_header(struct pprzParser* p) {
+    uint8_t classId = p->header[2] & 0x0F;
+    return p->length >= PPRZ_V2_MIN_LENGTH && classId >= PPRZ_CLASS_TELEMETRY && classId <= PPRZ_CLASS_INTERMCU;
+}
+
+static void pprz_header(struct pprzParser* p, struct pprzMessage* m) {
+    if(p->version == PPRZ_AUTO) {
+        if(!pprz_v2_header(p))
+            p->version = 1;
+        else if(++p->v2Messages >= PPRZ_DETECT_MESSAGES)
+            p->version = 2;
     }
-    if(checksumB != circularBuffer_peek(cb, l-1)) {
-        return PPRZ_BROKEN;
+    m->version = p->version;
+    m->sender = p->header[0];
+    if(p->version == 2) {
+        m->payload = 6;
+        m->dest = p->header[1];
+        m->classId = p->header[2] & 0x0F;
+        m->component = p->header[2] >> 4;
+        m->id = p->header[3];
+    } else {
+        m->payload = 4;
+        m->dest = PPRZ_BROADCAST;
+        m->classId = 0;
+        m->component = 0;
+        m->id = p->header[1];
     }
-    return PPRZ_OK;
 }
 
-uint8_t parsePPRZ(struct circularBuffer* cb) {
-    enum PPRZ_STATUS status = check_pprz(cb);
-    while(1) {
-        switch(status) {
-            case PPRZ_SHORT:
-                return 0;
-            case PPRZ_BROKEN:
-                circularBuffer_read_element(cb);
-                status = check_pprz(cb);
-                break;
-            case PPRZ_OK:
-                return circularBuffer_peek(cb, 1);
+int pprzParser_next(struct pprzParser* p, const struct circularBufferSpan span[2], struct pprzMessage* m) {
+    size_t total = span[0].length + span[1].length;
+    while(p->scanned < total) {
+        // after a broken message the search can go back into the first span
+        int k = p->scanned >= span[0].length;
+        size_t base = k ? span[0].length : 0;
+        const uint8_t* data = span[k].data;
+        size_t end = base + span[k].length;
+        size_t i = p->scanned;
+        if(p->state == PPRZ_WAIT_STX) {
+            const uint8_t* stx = memchr(data + (i - base), PPRZ_STX, end - i);
+            if(!stx) {
+                p->scanned = end;
+                continue;
+            }
+            p->scanned = base + (stx - data);
+        } else if(p->state == PPRZ_BODY && p->count >= 6 && p->count < p->length - 2) {
+            // the rest of the payload only goes into the checksums
+            size_t n = p->length - 2 - p->count;
+            if(n > end - i)
+                n = end - i;
+            const uint8_t* d = data + (i - base);
+            uint8_t checksumA = p->checksumA;
+            uint8_t checksumB = p->checksumB;
+            for(size_t j = 0; j < n; j++) {
+                checksumA += d[j];
+                checksumB += checksumA;
+            }
+            p->checksumA = checksumA;
+            p->checksumB = checksumB;
+            p->count += n;
+            p->scanned += n;
+            continue;
+        }
+        i = p->scanned++;
+        if(pprz_step(p, data[i - base], i)) {
+            m->offset = p->start;
+            m->length = p->length;
+            pprz_header(p, m);
+            // the caller drops everything up to the end of the message
+            p->scanned = 0;
+            return 1;
         }
     }
+    // all but the message in progress is garbage
+    m->offset = p->state == PPRZ_WAIT_STX ? p->scanned : p->start;
+    m->length = 0;
+    p->scanned -= m->offset;
+    p->start = 0;
     return 0;
 }
+
+// payload and checksums behind the header of idx bytes
+static uint8_t pprz_finish(uint8_t* message, uint8_t idx, const uint8_t* payload, uint8_t payload_length) {
+    for(uint8_t i = 0; i < payload_length; i++) {
+        message[idx++] = payload[i];
+    }
+    uint8_t checksumA = 0;
+    uint8_t checksumB = 0;
+    for(uint8_t i = 1; i < idx; i++) {
+        checksumA += message[i];
+        checksumB += checksumA;
+    }
+    message[idx++] = checksumA;
+    message[idx++] = checksumB;
+    return idx;
+}
+
+uint8_t pprz_pack(uint8_t* message, uint8_t sender, uint8_t msg_id, const uint8_t* payload, uint8_t payload_length) {
+    message[0] = PPRZ_STX;
+    message[1] = payload_length + 6;
+    message[2] = sender;
+    message[3] = msg_id;
+    return pprz_finish(message, 4, payload, payload_length);
+}
+
+uint8_t pprz_pack_v2(uint8_t* message, uint8_t sender, uint8_t dest, uint8_t classId, uint8_t component,
+        uint8_t msg_id, const uint8_t* payload, uint8_t payload_length) {
+    if(payload_length > 255 - PPRZ_V2_MIN_LENGTH)
+        return 0;
+    message[0] = PPRZ_STX;
+    message[1] = payload_length + PPRZ_V2_MIN_LENGTH;
+    message[2] = sender;
+    message[3] = dest;
+    message[4] = (component << 4) | (classId & 0x0F);
+    message[5] = msg_id;
+    return pprz_finish(message, 6, payload, payload_length);
+}
@@ -3,13 +3,70 @@
 
 #include "circular_buffer.h"
 
-enum PPRZ_STATUS {
-    PPRZ_OK,
-    PPRZ_SHORT,
-    PPRZ_BROKEN
+#define PPRZ_STX 0x99
+// STX, length, sender, id and two checksum bytes
+#define PPRZ_MIN_LENGTH 6
+// pprzlink 2.0: sender, destination, class/component and id after the length
+#define PPRZ_V2_MIN_LENGTH 8
+#define PPRZ_BROADCAST 0
+// class id in the low nibble of the v2 class byte, component id in the high one
+#define PPRZ_CLASS_TELEMETRY 1
+#define PPRZ_CLASS_DATALINK 2
+#define PPRZ_CLASS_GROUND 3
+#define PPRZ_CLASS_ALERT 4
+#define PPRZ_CLASS_INTERMCU 5
+
+// parser version: PPRZ_AUTO takes a stream for v1 at the first message that
+// can't be v2, for v2 after PPRZ_DETECT_MESSAGES that can, v1 until then
+#define PPRZ_AUTO 0
+#define PPRZ_DETECT_MESSAGES 8
+
+/*
+ * Resumable PPRZ parser over the readable spans of a ring: each call only
+ * looks at bytes it hasn't seen yet, every byte of a clean stream once, with
+ * running checksums. After a broken message it goes on with the byte after
+ * its STX.
+ */
+struct pprzParser {
+    uint8_t state;
+    uint8_t length;     // of the message in progress
+    uint8_t count;      // its bytes so far
+    uint8_t checksumA;
+    uint8_t checksumB;
+    uint8_t header[4];  // bytes after the length
+    uint8_t version;    // 1, 2 or PPRZ_AUTO while it isn't known
+    uint8_t v2Messages; // PPRZ_AUTO: messages in a row that can be v2
+    size_t start;       // of the message in progress, from the oldest byte
+    size_t scanned;     // bytes looked at, from the oldest byte
+    uint32_t errors;    // broken messages
 };
 
-enum PPRZ_STATUS check_pprz(struct circularBuffer* cb);
-uint8_t parsePPRZ(struct circularBuffer* cb);
+struct pprzMessage {
+    size_t offset;      // garbage in front of the message
+    uint8_t length;     // whole message, 0 if there is none complete yet
+    uint8_t version;    // PPRZ_AUTO while undecided, the fields are then as for v1
+    uint8_t payload;    // offset of the payload in the message
+    uint8_t sender;
+    uint8_t dest;       // PPRZ_BROADCAST for v1
+    uint8_t classId;    // 0 for v1
+    uint8_t component;
+    uint8_t id;
+};
+
+// version 1, 2 or PPRZ_AUTO
+void pprzParser_init(struct pprzParser* p, uint8_t version);
+// start over at the oldest byte, e.g. to leave a message in the ring for later
+void pprzParser_restart(struct pprzParser* p);
+// span: the readable bytes, as from circularBuffer_read_spans. Returns 1 with
+// a complete message in m. Before the next call the caller drops
+// m->offset + m->length bytes from the ring, with or without a message
+int pprzParser_next(struct pprzParser* p, const struct circularBufferSpan span[2], struct pprzMessage* m);
+
+// frame a payload as PPRZ message, message needs room for payload_length + 6 bytes
+uint8_t pprz_pack(uint8_t* message, uint8_t sender, uint8_t msg_id, const uint8_t* payload, uint8_t payload_length);
+// as pprzlink 2.0 message, message needs room for payload_length + 8 bytes.
+// Returns 0 if it would be longer than 255 bytes
+uint8_t pprz_pack_v2(uint8_t* message, uint8_t sender, uint8_t dest, uint8_t classId, uint8_t component,
+        uint8_t msg_id, const uint8_t* payload, uint8_t payload_length);
 
 #endif // include guard
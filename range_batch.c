@@ -0,0 +1,44 @@
+#include "range_batch.h"
+#include "pprz.h"
+#include "string.h"
+
+void rangeBatch_init(struct rangeBatch* rb, uint8_t maxEntries) {
+    if(maxEntries > RANGE_BATCH_MAX_ENTRIES)
+        maxEntries = RANGE_BATCH_MAX_ENTRIES;
+    rb->maxEntries = maxEntries;
+    rb->count = 0;
+    rb->stamp = 0;
+}
+
+int rangeBatch_add(struct rangeBatch* rb, uint32_t stamp, uint8_t src, uint8_t dest, float range, uint8_t quality, uint8_t nlos, int16_t rate) {
+    if(rb->count >= rb->maxEntries)
+        return 1;
+    if(rb->count == 0)
+        rb->stamp = stamp;
+    uint32_t dt = stamp - rb->stamp;
+    if(dt > 0xFFFF)
+        dt = 0xFFFF;
+    uint8_t* entry = rb->payload + RANGE_BATCH_HEADER_SIZE + rb->count * RANGE_BATCH_ENTRY_SIZE;
+    entry[0] = src;
+    entry[1] = dest;
+    memcpy(entry + 2, &range, sizeof(range));
+    entry[6] = quality;
+    entry[7] = nlos;
+    memcpy(entry + 8, &rate, sizeof(rate));
+    entry[10] = dt & 0xFF;
+    entry[11] = dt >> 8;
+    rb->count++;
+    return rb->count >= rb->maxEntries;
+}
+
+uint8_t rangeBatch_count(struct rangeBatch* rb) {
+    return rb->count;
+}
+
+uint8_t rangeBatch_pack(struct rangeBatch* rb, uint8_t sender, uint8_t msg_id, uint8_t* message) {
+    uint8_t entries_length = rb->count * RANGE_BATCH_ENTRY_SIZE;
+    memcpy(rb->payload, &rb->stamp, sizeof(rb->stamp));
+    rb->payload[4] = entries_length;
+    rb->count = 0;
+    return pprz_pack(message, sender, msg_id, rb->payload, RANGE_BATCH_HEADER_SIZE + entries_length);
+}
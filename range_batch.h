@@ -0,0 +1,28 @@
+#ifndef __range_batch_h
+#define __range_batch_h
+
+#include "inttypes.h"
+#include "stddef.h"
+
+// entry: src, dest, range (float), quality, nlos, range rate (int16 mm/s), ms since batch stamp (uint16)
+#define RANGE_BATCH_ENTRY_SIZE 12
+// header: stamp (uint32), array length
+#define RANGE_BATCH_HEADER_SIZE 5
+// 6 + 5 + 20 * 12 = 251 bytes, stays below the 255 byte PPRZ limit
+#define RANGE_BATCH_MAX_ENTRIES 20
+
+struct rangeBatch {
+    uint8_t payload[RANGE_BATCH_HEADER_SIZE + RANGE_BATCH_MAX_ENTRIES * RANGE_BATCH_ENTRY_SIZE];
+    uint8_t count;
+    uint8_t maxEntries;
+    uint32_t stamp;
+};
+
+void rangeBatch_init(struct rangeBatch* rb, uint8_t maxEntries);
+// returns 1 if the batch is full after adding and has to be flushed
+int rangeBatch_add(struct rangeBatch* rb, uint32_t stamp, uint8_t src, uint8_t dest, float range, uint8_t quality, uint8_t nlos, int16_t rate);
+uint8_t rangeBatch_count(struct rangeBatch* rb);
+// write the batch as PPRZ message into message (>= 255 bytes), returns its length and empties the batch
+uint8_t rangeBatch_pack(struct rangeBatch* rb, uint8_t sender, uint8_t msg_id, uint8_t* message);
+
+#endif // include guard
@@ -0,0 +1,51 @@
+#include "range_quality.h"
+
+static float clamp01(float x) {
+    if(x < 0)
+        return 0;
+    if(x > 1)
+        return 1;
+    return x;
+}
+
+void rangeQuality_reset(struct rangeQuality* q) {
+    q->frames = 0;
+    q->powerGap = 0;
+    q->snr = 0;
+}
+
+void rangeQuality_add(struct rangeQuality* q, float rxPower, float fpPower, float fpSnr) {
+    float gap = rxPower - fpPower;
+    if(q->frames == 0 || gap > q->powerGap)
+        q->powerGap = gap;
+    if(q->frames == 0 || fpSnr < q->snr)
+        q->snr = fpSnr;
+    if(q->frames < 255)
+        q->frames++;
+}
+
+static float nlos_likelihood(const struct rangeQuality* q) {
+    return clamp01((q->powerGap - RANGE_QUALITY_LOS_DB) / (RANGE_QUALITY_NLOS_DB - RANGE_QUALITY_LOS_DB));
+}
+
+uint8_t rangeQuality_nlos(const struct rangeQuality* q) {
+    if(q->frames == 0)
+        return 0;
+    return (uint8_t)(nlos_likelihood(q) * 255.0f + 0.5f);
+}
+
+uint8_t rangeQuality_score(const struct rangeQuality* q) {
+    if(q->frames == 0)
+        return RANGE_QUALITY_UNRATED;
+    float snr = clamp01((q->snr - RANGE_QUALITY_MIN_SNR) / (RANGE_QUALITY_GOOD_SNR - RANGE_QUALITY_MIN_SNR));
+    return 1 + (uint8_t)(254.0f * snr * (1.0f - nlos_likelihood(q)) + 0.5f);
+}
+
+void rangeQuality_merge(uint8_t* quality, uint8_t* nlos, uint8_t otherQuality, uint8_t otherNlos) {
+    if(otherQuality == RANGE_QUALITY_UNRATED)
+        return;
+    if(*quality == RANGE_QUALITY_UNRATED || otherQuality < *quality)
+        *quality = otherQuality;
+    if(otherNlos > *nlos)
+        *nlos = otherNlos;
+}
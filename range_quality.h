@@ -0,0 +1,36 @@
+#ifndef __range_quality_h
+#define __range_quality_h
+
+#include "inttypes.h"
+#include "stddef.h"
+
+// total minus first path power (dB): below LOS_DB line of sight, above NLOS_DB
+// the first path is attenuated and the range is likely too long (DecaWave APS006)
+#define RANGE_QUALITY_LOS_DB 6.0f
+#define RANGE_QUALITY_NLOS_DB 10.0f
+// first path amplitude over noise: at MIN_SNR the leading edge is barely
+// detectable, from GOOD_SNR on the timestamp is as good as it gets
+#define RANGE_QUALITY_MIN_SNR 2.0f
+#define RANGE_QUALITY_GOOD_SNR 10.0f
+// quality byte of a range that was not rated
+#define RANGE_QUALITY_UNRATED 0
+
+// receive diagnostics of the frames of one exchange, the worst frame counts
+struct rangeQuality {
+    uint8_t frames;
+    float powerGap;     // dB, largest total minus first path power
+    float snr;          // smallest first path amplitude over noise
+};
+
+void rangeQuality_reset(struct rangeQuality* q);
+// diagnostics of a received frame (dwGetReceivePower, dwGetFirstPathPower, dwGetReceiveQuality)
+void rangeQuality_add(struct rangeQuality* q, float rxPower, float fpPower, float fpSnr);
+
+// non line of sight likelihood, 0 (LOS) .. 255 (NLOS)
+uint8_t rangeQuality_nlos(const struct rangeQuality* q);
+// 1 (useless) .. 255 (best), RANGE_QUALITY_UNRATED without diagnostics
+uint8_t rangeQuality_score(const struct rangeQuality* q);
+// combine with the rating of the other end of the exchange, the worse one counts
+void rangeQuality_merge(uint8_t* quality, uint8_t* nlos, uint8_t otherQuality, uint8_t otherNlos);
+
+#endif // include guard
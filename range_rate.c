@@ -0,0 +1,56 @@
+#include "range_rate.h"
+
+void rangeRate_reset(struct rangeRate* r) {
+    r->newest = 0;
+    r->count = 0;
+    r->rate = 0;
+}
+
+float rangeRate_add(struct rangeRate* r, uint64_t ticks, float range) {
+    uint32_t now = (uint32_t)(ticks >> RANGE_RATE_STAMP_SHIFT);
+    r->newest = (r->newest + 1) % RANGE_RATE_WINDOW;
+    r->stamp[r->newest] = now;
+    r->range[r->newest] = range;
+    if(r->count < RANGE_RATE_WINDOW)
+        r->count++;
+    // times relative to the newest range, the stale end of the window is dropped
+    float t[RANGE_RATE_WINDOW];
+    float meanT = 0;
+    float meanR = 0;
+    uint8_t n = 0;
+    for(; n < r->count; n++) {
+        uint8_t i = (r->newest + RANGE_RATE_WINDOW - n) % RANGE_RATE_WINDOW;
+        t[n] = -(float)(now - r->stamp[i]) * RANGE_RATE_STAMP_S;
+        if(t[n] < -RANGE_RATE_MAX_SPAN)
+            break;
+        meanT += t[n];
+        meanR += r->range[i];
+    }
+    r->count = n;
+    if(n < 2) {
+        r->rate = RANGE_RATE_UNKNOWN;
+        return r->rate;
+    }
+    meanT /= n;
+    meanR /= n;
+    float stt = 0;
+    float str = 0;
+    for(uint8_t k = 0; k < n; k++) {
+        uint8_t i = (r->newest + RANGE_RATE_WINDOW - k) % RANGE_RATE_WINDOW;
+        float dt = t[k] - meanT;
+        stt += dt * dt;
+        str += dt * (r->range[i] - meanR);
+    }
+    if(stt > 0)
+        r->rate = str / stt;
+    return r->rate;
+}
+
+int16_t rangeRate_to_mm(float rate) {
+    float mm = rate * 1000.0f;
+    if(mm > 32767.0f)
+        return 32767;
+    if(mm < -32767.0f)
+        return -32767;
+    return (int16_t)(mm < 0 ? mm - 0.5f : mm + 0.5f);
+}
@@ -0,0 +1,33 @@
+#ifndef __range_rate_h
+#define __range_rate_h
+
+#include "inttypes.h"
+#include "stddef.h"
+
+// ranges in the least squares fit
+#define RANGE_RATE_WINDOW 8
+// older ranges are not fitted, the rate follows a manoeuvre within this time (s)
+#define RANGE_RATE_MAX_SPAN 1.0f
+// exchange times are kept as device time >> 8 (4 ns), wraps with the device time after 17s
+#define RANGE_RATE_STAMP_SHIFT 8
+#define RANGE_RATE_STAMP_S (256.0f / (499.2e6f * 128))
+// rate while fewer than 2 ranges are in the window
+#define RANGE_RATE_UNKNOWN 0
+
+// change of the range to one neighbour, the slope of a line fitted through
+// its last ranges over the exchange times of the own DW1000 clock
+struct rangeRate {
+    uint32_t stamp[RANGE_RATE_WINDOW];
+    float range[RANGE_RATE_WINDOW];
+    uint8_t newest;
+    uint8_t count;
+    float rate;             // m/s, positive when moving apart
+};
+
+void rangeRate_reset(struct rangeRate* r);
+// range measured in the exchange that started at ticks (device time), returns the new rate
+float rangeRate_add(struct rangeRate* r, uint64_t ticks, float range);
+// rate in mm/s for the frames and PPRZ messages, saturates at +-32.767 m/s
+int16_t rangeRate_to_mm(float rate);
+
+#endif // include guard
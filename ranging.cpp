@@ -21,6 +21,25 @@ void calculatePropagationFormula(const uint64_t& tRound1, const uint64_t& tReply
 	tPropTick = (double)((tRound1 * tRound2) - (tReply1 * tReply2)) / (tRound1 + tReply1 + tRound2 + tReply2);
 }
 
-double calculateDistanceFromTicks(uint64_t tprop) {
+void calculateSingleSidedPropagation(const uint64_t& tRound, const uint64_t& tReply, const double& rate, double& tPropTick){
+	tPropTick = ((double)tRound - rate * tReply) / 2;
+}
+
+double calculateDistanceFromTicks(double tprop) {
+    if(tprop < 0)
+        tprop = 0;
     return speedOfLight * tprop / tsfreq - MAGIC_RANGE_OFFSET;
 }
+
+int32_t rangeToMillimetres(double range) {
+    double mm = range * 1000.0;
+    if(mm >= INT32_MAX)
+        return INT32_MAX;
+    if(mm <= INT32_MIN)
+        return INT32_MIN;
+    return (int32_t)(mm < 0 ? mm - 0.5 : mm + 0.5);
+}
+
+double rangeFromMillimetres(int32_t range) {
+    return range * 0.001;
+}
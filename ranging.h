@@ -8,6 +8,33 @@ extern "C" {
 // offset of the ranging result in meters
 #define MAGIC_RANGE_OFFSET 153.7
 
+// ranging protocols the initiator can use, responders handle all of them
+#define RANGING_DS_TWR 0
+#define RANGING_SS_TWR 1
+#define RANGING_DS3_TWR 2
+// all pairs in rounds of chained frames, see snapshot.h
+#define RANGING_SNAPSHOT 3
+
+// payload of RANGE_TRANSFER: 3 timestamps (5 bytes), responder quality and nlos
+#define RANGE_TRANSFER_SIZE 17
+// payload of RANGE_DS3_FINAL: poll tx, response rx, final tx (5 bytes), initiator quality and nlos
+#define RANGE_FINAL_SIZE 17
+// payload of RANGE_DATA: range in m (double), quality (uint8), nlos (uint8), range rate (int16 mm/s)
+#define RANGE_DATA_SIZE 12
+// payload of RANGE_DATA_MM: range in mm (int32), quality (uint8), nlos (uint8), range rate (int16 mm/s)
+#define RANGE_MM_SIZE 8
+// older firmware sends RANGE_DATA and RANGE_DATA_MM without the trailing
+// fields and RANGE_TRANSFER without quality and nlos, receivers check the length
+// timestamps of RANGE_TRANSFER and RANGE_DS3_FINAL, a shorter frame is dropped
+#define RANGE_TIMESTAMPS_SIZE 15
+
+// payload of SNAPSHOT and SNAPSHOT_REPORT: round, slot, then the member count and
+// list (slot 0) or the packed report (report slots)
+#define SNAPSHOT_HEADER_SIZE 2
+
+// payload of PING and PONG: longest frame the sender receives (uint16, bytes with FCS)
+#define DISCOVERY_SIZE 2
+
 // size of the ranging frame without header
 #define NO_DATA_FRAME_SIZE 4
 
@@ -16,7 +43,7 @@ typedef struct __attribute__((packed, aligned(1))) DataFrame {
     uint8_t dest;
     uint8_t type;
     uint8_t seq; 
-    uint8_t data[15];
+    uint8_t data[17];
 }DFrame;
 
 enum FrameType{
@@ -27,7 +54,20 @@ enum FrameType{
     RANGE_TRANSFER=4,
     RANGE_DATA=5,
     RANGE_REQUEST=6,
+    RANGE_SS_POLL=7,
+    RANGE_SS_RESP=8,
+    RANGE_DATA_MM=9,
+    TIME_SYNC=10,
+    RANGE_DS3_POLL=11,
+    RANGE_DS3_RESP=12,
+    RANGE_DS3_FINAL=13,
+    SNAPSHOT=14,
+    SNAPSHOT_REPORT=15,
+    // PPRZ messages of the sender's autopilot: DATA_FRAME while the version of
+    // its link isn't known (and from older firmware), the others with it
     DATA_FRAME=42,
+    DATA_FRAME_V1=43,
+    DATA_FRAME_V2=44,
     PING=254,
     PONG=255
 };
@@ -36,8 +76,16 @@ void calculateDeltaTime(dwTime_t* startTime, dwTime_t* endTime, uint64_t* result
 
 void calculatePropagationFormula(const uint64_t& tRound1, const uint64_t& tReply1, const uint64_t& tRound2, const uint64_t& tReply2, double& tPropTick);
 
+// single-sided TWR, rate converts the responders reply time into local ticks
+void calculateSingleSidedPropagation(const uint64_t& tRound, const uint64_t& tReply, const double& rate, double& tPropTick);
+
 static const double tsfreq = 499.2e6 * 128; // Timestamp counter frequency
 static const double speedOfLight = 299792458.0; // Speed of light in m/s
 
-double calculateDistanceFromTicks(uint64_t tprop);
+// negative propagation times (short range and noise) count as 0
+double calculateDistanceFromTicks(double tprop);
+
+// fixed-point range encoding, saturates at the int32 limits
+int32_t rangeToMillimetres(double range);
+double rangeFromMillimetres(int32_t range);
 #endif // include guard
@@ -0,0 +1,142 @@
+#include "ranging_stats.h"
+#include "math.h"
+#include "string.h"
+
+#define NO_PEER 0xFF
+
+static void count(uint16_t* counter) {
+    if(*counter < 0xFFFF)
+        (*counter)++;
+}
+
+// bin k holds 2^k..2^(k+1)-1 us
+static void histogram_add(uint16_t* histogram, uint32_t us) {
+    uint8_t bin = 0;
+    while(us > 1 && bin < RANGING_STATS_BINS - 1) {
+        us >>= 1;
+        bin++;
+    }
+    count(&histogram[bin]);
+}
+
+// record of addr, an unused or the least recently updated one is taken over
+static struct rangingPeerStats* peer_stats(struct rangingStats* rs, uint8_t addr, uint32_t now) {
+    struct rangingPeerStats* oldest = &rs->peers[0];
+    for(uint8_t i = 0; i < RANGING_STATS_PEERS; i++) {
+        struct rangingPeerStats* p = &rs->peers[i];
+        if(p->addr == addr)
+            return p;
+        if(p->addr == NO_PEER) {
+            oldest = p;
+        } else if(oldest->addr != NO_PEER && (int32_t)(p->lastUpdate - oldest->lastUpdate) < 0) {
+            oldest = p;
+        }
+    }
+    oldest->addr = addr;
+    oldest->attempts = 0;
+    oldest->successes = 0;
+    oldest->rangeMean = 0;
+    oldest->rangeVar = 0;
+    oldest->lastUpdate = now;
+    return oldest;
+}
+
+void rangingStats_init(struct rangingStats* rs) {
+    memset(rs, 0, sizeof(*rs));
+    for(uint8_t i = 0; i < RANGING_STATS_PEERS; i++) {
+        rs->peers[i].addr = NO_PEER;
+    }
+    rs->peer = NO_PEER;
+}
+
+void rangingStats_sent(struct rangingStats* rs, uint8_t type, uint8_t peer) {
+    if(type >= RANGING_STATS_PHASES)
+        return;
+    count(&rs->sent[type]);
+    if(peer == rs->peer)
+        rs->phase = type;
+}
+
+void rangingStats_received(struct rangingStats* rs, uint8_t type, uint8_t peer) {
+    if(type >= RANGING_STATS_PHASES)
+        return;
+    count(&rs->received[type]);
+    if(peer == rs->peer)
+        rs->phase = type;
+}
+
+void rangingStats_turnaround(struct rangingStats* rs, uint32_t us) {
+    histogram_add(rs->turnaround, us);
+}
+
+void rangingStats_start(struct rangingStats* rs, uint8_t peer, uint32_t now) {
+    count(&rs->started);
+    count(&peer_stats(rs, peer, now)->attempts);
+    rs->peer = peer;
+    rs->phase = 0;
+    rs->exchangeStart = now;
+}
+
+void rangingStats_done(struct rangingStats* rs, uint8_t peer, uint32_t now) {
+    if(peer != rs->peer)
+        return;
+    count(&rs->completed);
+    count(&peer_stats(rs, peer, now)->successes);
+    histogram_add(rs->exchange, now - rs->exchangeStart);
+    rs->peer = NO_PEER;
+}
+
+void rangingStats_abort(struct rangingStats* rs) {
+    if(rs->peer == NO_PEER)
+        return;
+    count(&rs->aborted);
+    count(&rs->abortedIn[rs->phase]);
+    rs->peer = NO_PEER;
+}
+
+void rangingStats_range(struct rangingStats* rs, uint8_t peer, float range, uint32_t now) {
+    struct rangingPeerStats* p = peer_stats(rs, peer, now);
+    if(p->rangeMean == 0) {
+        p->rangeMean = range;
+    } else {
+        // exponentially weighted variance, follows a moving peer
+        float diff = range - p->rangeMean;
+        p->rangeMean += RANGING_STATS_VAR_GAIN * diff;
+        p->rangeVar = (1.0f - RANGING_STATS_VAR_GAIN) * (p->rangeVar + RANGING_STATS_VAR_GAIN * diff * diff);
+    }
+    p->lastUpdate = now;
+}
+
+static uint8_t* put16(uint8_t* payload, const uint16_t* values, uint8_t n) {
+    memcpy(payload, values, n * sizeof(uint16_t));
+    return payload + n * sizeof(uint16_t);
+}
+
+uint8_t rangingStats_pack(struct rangingStats* rs, uint32_t stamp, uint8_t* payload) {
+    uint8_t* p = payload;
+    memcpy(p, &stamp, sizeof(stamp));
+    p += sizeof(stamp);
+    uint16_t exchanges[3] = {rs->started, rs->completed, rs->aborted};
+    p = put16(p, exchanges, 3);
+    p = put16(p, rs->sent, RANGING_STATS_PHASES);
+    p = put16(p, rs->received, RANGING_STATS_PHASES);
+    p = put16(p, rs->abortedIn, RANGING_STATS_PHASES);
+    p = put16(p, rs->turnaround, RANGING_STATS_BINS);
+    p = put16(p, rs->exchange, RANGING_STATS_BINS);
+    uint8_t* length = p++;
+    *length = 0;
+    for(uint8_t i = 0; i < RANGING_STATS_PEERS; i++) {
+        struct rangingPeerStats* peer = &rs->peers[i];
+        if(peer->addr == NO_PEER)
+            continue;
+        float deviation = sqrtf(peer->rangeVar) * 1000.0f;
+        uint16_t mm = deviation > 0xFFFF ? 0xFFFF : (uint16_t)deviation;
+        p[0] = peer->addr;
+        memcpy(p + 1, &peer->attempts, 2);
+        memcpy(p + 3, &peer->successes, 2);
+        memcpy(p + 5, &mm, 2);
+        p += RANGING_STATS_PEER_SIZE;
+        *length += RANGING_STATS_PEER_SIZE;
+    }
+    return p - payload;
+}
@@ -0,0 +1,66 @@
+#ifndef __ranging_stats_h
+#define __ranging_stats_h
+
+#include "inttypes.h"
+#include "stddef.h"
+
+// counters per frame type RANGE_0..RANGE_DS3_FINAL (see FrameType in ranging.h)
+#define RANGING_STATS_PHASES 14
+// histogram bin k counts durations of 2^k..2^(k+1)-1 us, the last bin everything above
+#define RANGING_STATS_BINS 16
+// peers with their own success and variance record, the oldest is replaced
+#define RANGING_STATS_PEERS 8
+// per peer entry in the snapshot: addr, attempts (uint16), successes (uint16), range std dev (uint16 mm)
+#define RANGING_STATS_PEER_SIZE 7
+// weight of a new range in the variance filter
+#define RANGING_STATS_VAR_GAIN 0.1f
+// 4 + 6 + 3 * 28 + 2 * 32 + 1 + 8 * 7 = 215 bytes
+#define RANGING_STATS_SNAPSHOT_SIZE (4 + 3 * 2 + 3 * 2 * RANGING_STATS_PHASES + 2 * 2 * RANGING_STATS_BINS \
+        + 1 + RANGING_STATS_PEERS * RANGING_STATS_PEER_SIZE)
+
+struct rangingPeerStats {
+    uint8_t addr;
+    uint16_t attempts;
+    uint16_t successes;
+    float rangeMean;        // m, filtered
+    float rangeVar;         // m^2, filtered
+    uint32_t lastUpdate;    // us
+};
+
+// all counters are uint16 and saturate, a query with reset starts a new period
+struct rangingStats {
+    uint16_t started;
+    uint16_t completed;
+    uint16_t aborted;
+    uint16_t sent[RANGING_STATS_PHASES];
+    uint16_t received[RANGING_STATS_PHASES];
+    uint16_t abortedIn[RANGING_STATS_PHASES];   // last phase reached by aborted exchanges
+    uint16_t turnaround[RANGING_STATS_BINS];    // own reply delay
+    uint16_t exchange[RANGING_STATS_BINS];      // first frame to range as initiator
+    struct rangingPeerStats peers[RANGING_STATS_PEERS];
+    // exchange in progress as initiator, peer is 0xFF if none
+    uint8_t peer;
+    uint8_t phase;
+    uint32_t exchangeStart; // us
+};
+
+void rangingStats_init(struct rangingStats* rs);
+
+// ranging frame of type sent to or received from peer, other frame types are ignored
+void rangingStats_sent(struct rangingStats* rs, uint8_t type, uint8_t peer);
+void rangingStats_received(struct rangingStats* rs, uint8_t type, uint8_t peer);
+// time between the reception of a frame and the own reply (us)
+void rangingStats_turnaround(struct rangingStats* rs, uint32_t us);
+
+// exchange as initiator with peer, done is ignored for other peers than the started one
+void rangingStats_start(struct rangingStats* rs, uint8_t peer, uint32_t now);
+void rangingStats_done(struct rangingStats* rs, uint8_t peer, uint32_t now);
+// the started exchange did not finish
+void rangingStats_abort(struct rangingStats* rs);
+// range measured to peer, feeds its variance
+void rangingStats_range(struct rangingStats* rs, uint8_t peer, float range, uint32_t now);
+
+// write the snapshot (RANGING_STATS_SNAPSHOT_SIZE bytes max) into payload, returns its length
+uint8_t rangingStats_pack(struct rangingStats* rs, uint32_t stamp, uint8_t* payload);
+
+#endif // include guard
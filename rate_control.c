@@ -0,0 +1,78 @@
+#include "rate_control.h"
+#include "math.h"
+
+void rateControl_init(struct rateControl* rc, uint32_t now) {
+    rc->airtime = 0;
+    rc->windowStart = now;
+    rc->load = 0;
+    rc->queue = 0;
+    rc->loss = 0;
+    rc->scale = 1.0f;
+}
+
+uint32_t rateControl_airtime(unsigned int length) {
+    // 850 kbps, 128 symbol preamble: preamble, SFD and PHR take about 167us,
+    // a byte incl. Reed-Solomon parity about 10.8us, plus 2 bytes CRC
+    return 167 + (length + 2) * 108 / 10;
+}
+
+void rateControl_tx(struct rateControl* rc, unsigned int length) {
+    rc->airtime += rateControl_airtime(length);
+}
+
+void rateControl_rx(struct rateControl* rc, unsigned int length) {
+    rc->airtime += rateControl_airtime(length);
+}
+
+void rateControl_rx_failed(struct rateControl* rc) {
+    rc->airtime += RATE_RX_FRAME_US;
+}
+
+void rateControl_update(struct rateControl* rc, uint32_t now, float queueFill, float loss) {
+    uint32_t window = now - rc->windowStart;
+    if(window == 0)
+        return;
+    float load = (float)rc->airtime / window;
+    if(load > 1.0f)
+        load = 1.0f;
+    rc->load += RATE_FILTER_GAIN * (load - rc->load);
+    rc->queue = queueFill;
+    rc->loss = loss;
+    rc->airtime = 0;
+    rc->windowStart = now;
+
+    // integrating controller: shorten the intervals while there is free airtime,
+    // back off before the channel saturates, when exchanges get lost and
+    // before telemetry piles up
+    float ratio = rc->load / RATE_TARGET_LOAD;
+    float queueRatio = rc->queue / RATE_QUEUE_BACKOFF;
+    if(queueRatio > ratio)
+        ratio = queueRatio;
+    float lossRatio = rc->loss / RATE_LOSS_BACKOFF;
+    if(lossRatio > ratio)
+        ratio = lossRatio;
+    if(ratio > 4.0f)
+        ratio = 4.0f;
+    rc->scale *= 1.0f + RATE_FILTER_GAIN * (ratio - 1.0f);
+    if(rc->scale < RATE_MIN_SCALE)
+        rc->scale = RATE_MIN_SCALE;
+    if(rc->scale > RATE_MAX_SCALE)
+        rc->scale = RATE_MAX_SCALE;
+}
+
+uint32_t rateControl_interval(struct rateControl* rc, const struct neighbour* n) {
+    float speed = fabsf(n->rangeRate.rate);
+    if(speed < 0.01f)
+        speed = 0.01f;
+    float interval = RATE_RANGE_STEP / speed * 1e6f;
+    if(interval > RATE_MAX_PEER_US)
+        interval = RATE_MAX_PEER_US;
+    // neighbours that often fail get fewer polls
+    interval *= 1.0f + 4.0f * n->lossRate;
+    interval *= rc->scale;
+    if(interval < RATE_MIN_PEER_US)
+        return RATE_MIN_PEER_US;
+    if(interval > RATE_MAX_PEER_US * RATE_MAX_SCALE)
+        return RATE_MAX_PEER_US * RATE_MAX_SCALE;
+    return (uint32_t)interval;
+}
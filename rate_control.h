@@ -0,0 +1,53 @@
+#ifndef __rate_control_h
+#define __rate_control_h
+
+#include "inttypes.h"
+#include "stddef.h"
+#include "neighbour_table.h"
+
+// limits of the time between two polls of the same neighbour, before
+// the global scale is applied to the upper one
+#define RATE_MIN_PEER_US 10000
+#define RATE_MAX_PEER_US 1000000
+// poll often enough that the range changes by about this much in between (m)
+#define RATE_RANGE_STEP 0.05f
+// channel load (share of airtime in use) above which ranging backs off
+// (random access collapses early, keep well below the ALOHA limit of 18%)
+#define RATE_TARGET_LOAD 0.10f
+// telemetry queue fill above which ranging backs off
+#define RATE_QUEUE_BACKOFF 0.25f
+// mean exchange loss above which ranging backs off, collisions show up here
+// even where the load estimate misses them
+#define RATE_LOSS_BACKOFF 0.3f
+// airtime assumed for a frame that didn't decode (us), its length is unknown
+#define RATE_RX_FRAME_US 200
+// limits of the global factor applied to all intervals
+#define RATE_MIN_SCALE 0.01f
+#define RATE_MAX_SCALE 20.0f
+// weight of a new measurement in the load and scale filters
+#define RATE_FILTER_GAIN 0.25f
+
+struct rateControl {
+    uint32_t airtime;       // us of airtime seen since windowStart
+    uint32_t windowStart;
+    float load;             // filtered share of airtime in use
+    float queue;            // telemetry queue fill
+    float loss;             // mean exchange loss of the neighbours
+    float scale;            // global factor applied to all intervals
+};
+
+void rateControl_init(struct rateControl* rc, uint32_t now);
+// account a frame sent (length bytes) on the channel
+void rateControl_tx(struct rateControl* rc, unsigned int length);
+// account a frame received on the channel (length bytes)
+void rateControl_rx(struct rateControl* rc, unsigned int length);
+// account a reception that failed or timed out, the channel was busy all the same
+void rateControl_rx_failed(struct rateControl* rc);
+// recompute load and global scale, queueFill and loss are 0..1
+void rateControl_update(struct rateControl* rc, uint32_t now, float queueFill, float loss);
+// time until the neighbour should be polled again (us)
+uint32_t rateControl_interval(struct rateControl* rc, const struct neighbour* n);
+// airtime of a frame with length bytes payload (us)
+uint32_t rateControl_airtime(unsigned int length);
+
+#endif // include guard
@@ -0,0 +1,15 @@
+#include "routing_table.h"
+
+void routingTable_init(struct routingTable* rt) {
+    for(int i = 0; i < 256; i++) {
+        rt->addr[i] = ROUTE_NONE;
+    }
+}
+
+void routingTable_learn(struct routingTable* rt, uint8_t acId, uint8_t addr) {
+    rt->addr[acId] = addr;
+}
+
+uint8_t routingTable_lookup(struct routingTable* rt, uint8_t acId) {
+    return rt->addr[acId];
+}
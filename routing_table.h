@@ -0,0 +1,25 @@
+#ifndef __routing_table_h
+#define __routing_table_h
+
+#include "inttypes.h"
+#include "stddef.h"
+
+// no route known, the UWB broadcast address
+#define ROUTE_NONE 0
+
+/*
+ * PPRZ AC_ID -> UWB address of the node whose autopilot it is, learned from
+ * the senders of the messages in received DATA_FRAMEs. One byte per AC_ID,
+ * so a lookup in another thread never sees half an update.
+ */
+struct routingTable {
+    uint8_t addr[256];
+};
+
+void routingTable_init(struct routingTable* rt);
+// acId sent a message through the node addr
+void routingTable_learn(struct routingTable* rt, uint8_t acId, uint8_t addr);
+// ROUTE_NONE if unknown
+uint8_t routingTable_lookup(struct routingTable* rt, uint8_t acId);
+
+#endif // include guard
@@ -0,0 +1,237 @@
+/*
+ * Virtual DW1000: implements the libdw1000 calls used by the firmware on top
+ * of simRadio. Frames and timestamps are exchanged with the simulator through
+ * simHost, interrupts are delivered through dwHandleInterrupt as on hardware.
+ */
+#include "libdw1000.h"
+#include "libdw1000Spi.h"
+#include "sim_node.h"
+#include "cir_capture.h"
+#include "math.h"
+#include "string.h"
+
+struct simRadio simRadio;
+
+const uint8_t MODE_LONGDATA_RANGE_LOWPOWER[] = {TRX_RATE_110KBPS, TX_PULSE_FREQ_16MHZ, TX_PREAMBLE_LEN_2048};
+const uint8_t MODE_SHORTDATA_FAST_LOWPOWER[] = {TRX_RATE_6800KBPS, TX_PULSE_FREQ_16MHZ, TX_PREAMBLE_LEN_128};
+const uint8_t MODE_LONGDATA_FAST_LOWPOWER[] = {TRX_RATE_6800KBPS, TX_PULSE_FREQ_16MHZ, TX_PREAMBLE_LEN_1024};
+const uint8_t MODE_SHORTDATA_FAST_ACCURACY[] = {TRX_RATE_6800KBPS, TX_PULSE_FREQ_64MHZ, TX_PREAMBLE_LEN_128};
+const uint8_t MODE_LONGDATA_FAST_ACCURACY[] = {TRX_RATE_6800KBPS, TX_PULSE_FREQ_64MHZ, TX_PREAMBLE_LEN_1024};
+const uint8_t MODE_LONGDATA_RANGE_ACCURACY[] = {TRX_RATE_110KBPS, TX_PULSE_FREQ_64MHZ, TX_PREAMBLE_LEN_2048};
+const uint8_t MODE_SHORTDATA_MID_ACCURACY[] = {TRX_RATE_850KBPS, TX_PULSE_FREQ_64MHZ, TX_PREAMBLE_LEN_128};
+const uint8_t MODE_LONGDATA_MID_ACCURACY[] = {TRX_RATE_850KBPS, TX_PULSE_FREQ_64MHZ, TX_PREAMBLE_LEN_1024};
+
+static void set_stamp(dwTime_t* time, uint64_t stamp) {
+    // like the SPI read only the 5 timestamp bytes are written
+    memcpy(time->raw, &stamp, 5);
+}
+
+void dwInit(dwDevice_t* dev, dwOps_t* ops) {
+    memset(dev, 0, sizeof(*dev));
+    dev->ops = ops;
+    dev->deviceMode = IDLE_MODE;
+    dev->frameCheck = true;
+}
+
+int dwConfigure(dwDevice_t* dev) {
+    return DW_ERROR_OK;
+}
+
+void dwEnableAllLeds(dwDevice_t* dev) {}
+void dwSetAntenaDelay(dwDevice_t* dev, dwTime_t delay) { dev->antennaDelay = delay; }
+
+void dwAttachSentHandler(dwDevice_t* dev, dwHandler_t handler) { dev->handleSent = handler; }
+void dwAttachReceivedHandler(dwDevice_t* dev, dwHandler_t handler) { dev->handleReceived = handler; }
+void dwAttachReceiveTimeoutHandler(dwDevice_t* dev, dwHandler_t handler) { dev->handleReceiveTimeout = handler; }
+void dwAttachReceiveFailedHandler(dwDevice_t* dev, dwHandler_t handler) { dev->handleReceiveFailed = handler; }
+
+void dwInterruptOnSent(dwDevice_t* dev, bool val) {}
+void dwInterruptOnReceived(dwDevice_t* dev, bool val) {}
+void dwInterruptOnReceiveFailed(dwDevice_t* dev, bool val) {}
+void dwInterruptOnReceiveTimeout(dwDevice_t* dev, bool val) {}
+
+void dwNewConfiguration(dwDevice_t* dev) { dwIdle(dev); }
+void dwCommitConfiguration(dwDevice_t* dev) {}
+void dwSetDefaults(dwDevice_t* dev) {}
+void dwEnableMode(dwDevice_t* dev, const uint8_t mode[]) {}
+void dwSetChannel(dwDevice_t* dev, uint8_t channel) { dev->channel = channel; }
+void dwSetPreambleCode(dwDevice_t* dev, uint8_t preacode) { dev->preambleCode = preacode; }
+void dwReceivePermanently(dwDevice_t* dev, bool val) { dev->permanentReceive = val; }
+
+void dwUseExtendedFrameLength(dwDevice_t* dev, bool val) {
+    dev->extendedFrameLength = (val ? FRAME_LENGTH_EXTENDED : FRAME_LENGTH_NORMAL);
+}
+
+void dwIdle(dwDevice_t* dev) {
+    dev->deviceMode = IDLE_MODE;
+    simHost->radio_idle(simHost->node);
+}
+
+void dwNewReceive(dwDevice_t* dev) {
+    dwIdle(dev);
+    dev->deviceMode = RX_MODE;
+}
+
+void dwStartReceive(dwDevice_t* dev) {
+    dev->deviceMode = RX_MODE;
+    simHost->radio_receive(simHost->node);
+}
+
+void dwNewTransmit(dwDevice_t* dev) {
+    dwIdle(dev);
+    simRadio.txDelayed = false;
+    dev->deviceMode = TX_MODE;
+}
+
+void dwSetData(dwDevice_t* dev, uint8_t data[], unsigned int n) {
+    unsigned int length = n + (dev->frameCheck ? 2 : 0);
+    // same silent limits as the real driver
+    if(length > LEN_EXT_UWB_FRAMES)
+        return;
+    if(length > LEN_UWB_FRAMES && !dev->extendedFrameLength)
+        return;
+    memcpy(simRadio.tx, data, n);
+    simRadio.txLength = n;
+}
+
+// only the TX buffer is backed, other register writes are ignored
+void dwSpiWrite(dwDevice_t* dev, uint8_t regid, uint32_t address, const void* data, size_t length) {
+    if(regid == TX_BUFFER && address + length <= sizeof(simRadio.tx))
+        memcpy(simRadio.tx + address, data, length);
+}
+
+void dwSpiWrite8(dwDevice_t* dev, uint8_t regid, uint32_t address, uint8_t data) {
+    dwSpiWrite(dev, regid, address, &data, 1);
+}
+
+// synthetic accumulator: the first path and a later, stronger reflection,
+// scaled so that their powers match fpPower and rxPower
+#define SIM_FP_INDEX 745
+#define SIM_REFLECTION_DELAY 3
+
+static int16_t sim_accumulator(uint32_t sample, int imaginary) {
+    float fp = powf(10.0f, (simRadio.fpPower + 150.0f) / 20.0f);
+    float reflection = powf(10.0f, (simRadio.rxPower + 150.0f) / 20.0f) - fp;
+    float value = 0;
+    int32_t d = (int32_t)sample - SIM_FP_INDEX;
+    if(d >= 0 && d < 2)
+        value += fp * (d ? 0.5f : 1.0f);
+    d -= SIM_REFLECTION_DELAY;
+    if(d >= 0 && d < 3 && reflection > 0)
+        value += reflection * (d == 1 ? 1.0f : 0.5f);
+    // the reflection arrives with a different phase
+    return (int16_t)(imaginary ? value * 0.3f : value);
+}
+
+// reads return zeros except for the RX buffer, the accumulator and the first path index
+void dwSpiRead(dwDevice_t* dev, uint8_t regid, uint32_t address, void* data, size_t length) {
+    uint8_t* p = (uint8_t*)data;
+    memset(p, 0, length);
+    if(regid == CIR_ACC_MEM) {
+        // the first byte read from the accumulator is a dummy byte
+        for(size_t i = 1; i < length; i++) {
+            uint32_t offset = address + i - 1;
+            int16_t value = sim_accumulator(offset / 4, (offset / 2) & 1);
+            p[i] = (uint8_t)(value >> (8 * (offset & 1)));
+        }
+    } else if(regid == RX_BUFFER && address < sizeof(simRadio.rx)) {
+        if(length > sizeof(simRadio.rx) - address)
+            length = sizeof(simRadio.rx) - address;
+        memcpy(p, simRadio.rx + address, length);
+    } else if(regid == RX_TIME && address == CIR_FP_INDEX_SUB && length == 2) {
+        uint16_t index = SIM_FP_INDEX << 6;
+        memcpy(p, &index, 2);
+    }
+}
+
+uint16_t dwSpiRead16(dwDevice_t* dev, uint8_t regid, uint32_t address) {
+    uint16_t data;
+    dwSpiRead(dev, regid, address, &data, sizeof(data));
+    return data;
+}
+
+void dwSetTxRxTime(dwDevice_t* dev, const dwTime_t futureTime) {
+    if(dev->deviceMode != TX_MODE)
+        return;
+    simRadio.txDelayed = true;
+    simRadio.txTime = futureTime.full & 0xFFFFFFFE00ULL;
+}
+
+dwTime_t dwSetDelay(dwDevice_t* dev, const dwTime_t* delay) {
+    dwTime_t futureTime = {.full = 0};
+    if(dev->deviceMode != TX_MODE)
+        return futureTime;
+    futureTime.full = (simHost->device_time(simHost->node) + delay->full) & 0xFFFFFFFE00ULL;
+    dwSetTxRxTime(dev, futureTime);
+    futureTime.full += dev->antennaDelay.full;
+    return futureTime;
+}
+
+void dwStartTransmit(dwDevice_t* dev) {
+    dev->deviceMode = IDLE_MODE;
+    simHost->radio_transmit(simHost->node, simRadio.tx, simRadio.txLength, simRadio.txDelayed, simRadio.txTime);
+}
+
+unsigned int dwGetDataLength(dwDevice_t* dev) {
+    return simRadio.rxLength;
+}
+
+void dwGetData(dwDevice_t* dev, uint8_t data[], unsigned int n) {
+    if(n > sizeof(simRadio.rx))
+        n = sizeof(simRadio.rx);
+    memcpy(data, simRadio.rx, n);
+}
+
+void dwGetTransmitTimestamp(dwDevice_t* dev, dwTime_t* time) {
+    set_stamp(time, simRadio.txStamp);
+}
+
+void dwGetReceiveTimestamp(dwDevice_t* dev, dwTime_t* time) {
+    time->full = 0;
+    set_stamp(time, simRadio.rxStamp);
+}
+
+void dwGetRawReceiveTimestamp(dwDevice_t* dev, dwTime_t* time) {
+    time->full = 0;
+    set_stamp(time, simRadio.rxStamp);
+}
+
+void dwGetSystemTimestamp(dwDevice_t* dev, dwTime_t* time) {
+    set_stamp(time, simHost->device_time(simHost->node));
+}
+
+float dwGetReceivePower(dwDevice_t* dev) {
+    return simRadio.rxPower;
+}
+
+float dwGetFirstPathPower(dwDevice_t* dev) {
+    return simRadio.fpPower;
+}
+
+float dwGetReceiveQuality(dwDevice_t* dev) {
+    // first path amplitude over noise, high for line of sight
+    return 15.0f + (simRadio.fpPower - simRadio.rxPower) * 0.5f;
+}
+
+void dwHandleInterrupt(dwDevice_t* dev) {
+    if(simRadio.txDone && dev->handleSent) {
+        simRadio.txDone = false;
+        dev->handleSent(dev);
+    }
+    if(simRadio.rxFailed) {
+        simRadio.rxFailed = false;
+        if(dev->handleReceiveFailed)
+            dev->handleReceiveFailed(dev);
+    } else if(simRadio.rxDone && simRadio.rxLength + (dev->frameCheck ? 2 : 0) > LEN_UWB_FRAMES
+            && !dev->extendedFrameLength) {
+        // the PHR of a long frame only decodes in the same mode
+        simRadio.rxDone = false;
+        if(dev->handleReceiveFailed)
+            dev->handleReceiveFailed(dev);
+    } else if(simRadio.rxDone) {
+        simRadio.rxDone = false;
+        dev->deviceMode = IDLE_MODE;
+        if(dev->handleReceived)
+            dev->handleReceived(dev);
+    }
+}
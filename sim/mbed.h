@@ -0,0 +1,177 @@
+#ifndef __sim_mbed_h
+#define __sim_mbed_h
+/*
+ * Minimal host stand-in for the parts of mbed-os used by the firmware.
+ * Timers and deferred calls are collected and driven by the simulator,
+ * serial ports and the radio are forwarded to simHost.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <deque>
+#include <functional>
+#include <vector>
+#include "sim_node.h"
+
+enum PinName { LED1, LED2, SPI_MOSI, SPI_MISO, SPI_SCK, SPI_CS, PA_0, PA_1, PA_2, PA_3, PA_9, PA_10 };
+enum PinMode { PullNone, PullUp, PullDown };
+
+namespace sim {
+struct PeriodicCall {
+    int period_ms;
+    std::function<void()> fn;
+};
+std::vector<PeriodicCall>& periodic();
+std::deque<std::function<void()> >& deferred();
+extern std::function<void()> irqHandler;
+}
+
+inline uint32_t us_ticker_read() {
+    return simHost->micros(simHost->node);
+}
+inline void wait(float s) {}
+// one thread at a time runs in the simulation
+inline void core_util_critical_section_enter() {}
+inline void core_util_critical_section_exit() {}
+inline uint32_t core_util_atomic_incr_u32(uint32_t* valuePtr, uint32_t delta) {
+    return *valuePtr += delta;
+}
+inline void wait_ms(int ms) {}
+inline void wait_us(int us) {}
+
+class DigitalOut {
+public:
+    DigitalOut(PinName pin) : value(0) {}
+    DigitalOut& operator=(int v) { value = v; return *this; }
+    operator int() { return value; }
+private:
+    int value;
+};
+
+class DigitalInOut {
+public:
+    DigitalInOut(PinName pin) {}
+    void output() {}
+    void input() {}
+    DigitalInOut& operator=(int v) { return *this; }
+};
+
+class InterruptIn {
+public:
+    InterruptIn(PinName pin) {}
+    int read() { return 0; }
+    void mode(PinMode pull) {}
+    template<typename F> void rise(F f) { sim::irqHandler = f; }
+};
+
+class SPI {
+public:
+    SPI(PinName mosi, PinName miso, PinName sck) {}
+    void lock() {}
+    void unlock() {}
+    int write(int value) { return 0; }
+    void frequency(int hz) {}
+};
+
+class SerialBase {
+public:
+    enum Parity { None, Odd, Even };
+    enum IrqType { RxIrq, TxIrq };
+};
+
+class Serial : public SerialBase {};
+
+// ports are numbered in construction order: uart1 (telemetry) is 0, uart2 (debug) is 1
+class RawSerial : public SerialBase {
+public:
+    RawSerial(PinName tx, PinName rx, int baud) : txPin(tx), rxPin(rx), port(count()++) { ports()[port] = this; }
+    int putc(int c) { simHost->uart_putc(simHost->node, port, (uint8_t)c); return c; }
+    int getc() {
+        if(input.empty())
+            return -1;
+        uint8_t c = input.front();
+        input.pop_front();
+        return c;
+    }
+    bool readable() { return !input.empty(); }
+    bool writeable() { return true; }
+    int printf(const char* format, ...) {
+        char buffer[256];
+        va_list args;
+        va_start(args, format);
+        int l = vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        for(int i = 0; i < l && i < (int)sizeof(buffer) - 1; i++) {
+            putc(buffer[i]);
+        }
+        return l;
+    }
+    void baud(int baudrate) {}
+    void format(int bits, Parity parity, int stop) {}
+    template<typename F> void attach(F f, IrqType type = RxIrq) {
+        if(type == RxIrq)
+            rxHandler = f;
+    }
+    // called by the simulator
+    void receive(const uint8_t* data, unsigned int length) {
+        if(burstHandler) {
+            burstHandler(data, length);
+            return;
+        }
+        for(unsigned int i = 0; i < length; i++) {
+            input.push_back(data[i]);
+        }
+        if(rxHandler)
+            rxHandler();
+    }
+    static RawSerial*& port_at(int p) { return ports()[p]; }
+    static RawSerial* with_pin(PinName pin) {
+        for(int p = 0; p < count(); p++) {
+            if(ports()[p]->txPin == pin || ports()[p]->rxPin == pin)
+                return ports()[p];
+        }
+        return NULL;
+    }
+    // DMA reception (uart_dma_sim.cpp), a message from the simulator is one burst
+    std::function<void(const uint8_t*, unsigned int)> burstHandler;
+    PinName txPin;
+    PinName rxPin;
+private:
+    static int& count() { static int c = 0; return c; }
+    static RawSerial** ports() { static RawSerial* p[4]; return p; }
+    int port;
+    std::deque<uint8_t> input;
+    std::function<void()> rxHandler;
+};
+
+#define EVENTS_EVENT_SIZE 32
+
+class EventQueue {
+public:
+    EventQueue(unsigned size) {}
+    template<typename F> int call_every(int ms, F f) {
+        sim::periodic().push_back(sim::PeriodicCall{ms, f});
+        return (int)sim::periodic().size();
+    }
+    template<typename F, typename... Args> int call(F f, Args... args) {
+        sim::deferred().push_back(std::bind(f, args...));
+        return 1;
+    }
+    template<typename F> F event(F f) { return f; }
+    void dispatch_forever() {}
+};
+
+struct Callback {};
+template<typename T, typename M> Callback callback(T* obj, M method) { return Callback(); }
+
+enum osPriority { osPriorityLow, osPriorityNormal, osPriorityHigh, osPriorityRealtime };
+
+class Thread {
+public:
+    void start(Callback task) {}
+    void set_priority(osPriority priority) {}
+    static void yield() {}
+};
+
+#endif // include guard
@@ -0,0 +1,112 @@
+/*
+ * Host check of the position solver (multilateration.c) with noisy ranges.
+ *
+ * Five anchors around a 20 x 20 m area at different heights, ranges to a
+ * fixed true position with gaussian noise. Every solve starts warm from the
+ * previous solution as on the node, the first one from the origin. Prints
+ * the mean solved position, its bias, the spread per axis and the mean rms
+ * residual. The anchors span 4 m in height only, z spreads several times
+ * wider than x and y.
+ *
+ * Usage: mlat_bench [-n noise cm] [-x solves] [-s seed]
+ */
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+extern "C" {
+#include "../multilateration.h"
+}
+
+static const struct mlatAnchor ANCHORS[] = {
+    {101, 0.0f, 0.0f, 0.0f},
+    {102, 20.0f, 0.0f, 0.5f},
+    {103, 0.0f, 20.0f, 1.0f},
+    {104, 20.0f, 20.0f, 3.0f},
+    {105, 10.0f, -5.0f, 4.0f},
+};
+static const double TRUTH[3] = {7.0, 12.0, 1.5};
+
+static uint32_t seed = 1;
+
+static double uniform() {
+    seed = seed * 1103515245 + 12345;
+    return ((seed >> 8) + 0.5) / (1 << 24);
+}
+
+static double gaussian() {
+    return sqrt(-2 * log(uniform())) * cos(2 * M_PI * uniform());
+}
+
+int main(int argc, char** argv) {
+    double noise = 5;
+    unsigned solves = 1000;
+    int opt;
+    while((opt = getopt(argc, argv, "n:x:s:")) != -1) {
+        switch(opt) {
+            case 'n': noise = atof(optarg); break;
+            case 'x': solves = atoi(optarg); break;
+            case 's': seed = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-n noise cm] [-x solves] [-s seed]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(solves < 1) {
+        fprintf(stderr, "solves need at least 1\n");
+        return 1;
+    }
+    const uint8_t count = sizeof(ANCHORS) / sizeof(ANCHORS[0]);
+    struct mlat m;
+    mlat_init(&m, ANCHORS, count);
+    double sum[3] = {0, 0, 0};
+    double squares[3] = {0, 0, 0};
+    double rmsSum = 0;
+    unsigned failed = 0;
+    for(unsigned i = 0; i < solves; i++) {
+        uint32_t now = i * 100000;
+        for(uint8_t a = 0; a < count; a++) {
+            double dx = ANCHORS[a].x - TRUTH[0];
+            double dy = ANCHORS[a].y - TRUTH[1];
+            double dz = ANCHORS[a].z - TRUTH[2];
+            double range = sqrt(dx * dx + dy * dy + dz * dz) + noise / 100 * gaussian();
+            mlat_add_range(&m, ANCHORS[a].addr, (float)range, now);
+        }
+        float position[3];
+        float rms;
+        if(mlat_solve(&m, now, 500000, position, &rms) != count) {
+            failed++;
+            continue;
+        }
+        for(int k = 0; k < 3; k++) {
+            sum[k] += position[k];
+            squares[k] += position[k] * position[k];
+        }
+        rmsSum += rms;
+    }
+    unsigned solved = solves - failed;
+    if(!solved) {
+        fprintf(stderr, "no solution\n");
+        return 1;
+    }
+    double mean[3];
+    double spread[3];
+    for(int k = 0; k < 3; k++) {
+        mean[k] = sum[k] / solved;
+        spread[k] = solved > 1 ? sqrt(fmax(0, (squares[k] - solved * mean[k] * mean[k]) / (solved - 1))) : 0;
+    }
+    double bias = sqrt((mean[0] - TRUTH[0]) * (mean[0] - TRUTH[0]) + (mean[1] - TRUTH[1]) * (mean[1] - TRUTH[1])
+                       + (mean[2] - TRUTH[2]) * (mean[2] - TRUTH[2]));
+    printf("%u anchors, +-%.1f cm range noise, %u solves, %u failed\n", count, noise, solves, failed);
+    printf("true %.2f/%.2f/%.2f m, mean %.2f/%.2f/%.2f m, bias %.1f cm\n",
+           TRUTH[0], TRUTH[1], TRUTH[2], mean[0], mean[1], mean[2], bias * 100);
+    printf("std x/y/z %.1f/%.1f/%.1f cm, rms residual %.1f cm\n",
+           spread[0] * 100, spread[1] * 100, spread[2] * 100, rmsSum / solved * 100);
+    // the mean has to converge on the true position, within the range noise
+    if(failed || bias > noise / 100) {
+        fprintf(stderr, "position off by more than the range noise\n");
+        return 1;
+    }
+    return 0;
+}
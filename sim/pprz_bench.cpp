@@ -0,0 +1,175 @@
+/*
+ * Host benchmark of the PPRZ parser (pprz.c) against the former one, which
+ * checked the whole message at the head of the buffer on every call and
+ * dropped one byte after an error.
+ *
+ * A stream of random messages (8..64 bytes) goes through a 2048 byte ring
+ * in pieces of up to 128 bytes, as from the UART DMA. -e corrupts bytes,
+ * -g inserts garbage between messages (per mille of the bytes), -f puts a
+ * fake STX and length in front of messages (per mille of the messages), as
+ * a message cut off by a lost chunk. Exits with 1 if the parser misses a
+ * message of a stream without errors and garbage.
+ *
+ * Usage: pprz_bench [-m MB] [-e errors] [-g garbage] [-f fakes] [-s seed]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <vector>
+extern "C" {
+#include "../pprz.h"
+}
+
+static uint32_t seed = 1;
+
+static uint32_t random32() {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+static std::vector<uint8_t> stream(size_t bytes, unsigned errors, unsigned garbage, unsigned fakes, size_t* messages) {
+    std::vector<uint8_t> s;
+    *messages = 0;
+    uint8_t payload[64];
+    uint8_t message[70];
+    while(s.size() < bytes) {
+        if(random32() % 1000 < garbage) {
+            for(uint32_t i = random32() % 16; i > 0; i--) {
+                s.push_back(random32());
+            }
+        }
+        // claims the bytes of the messages behind it
+        if(fakes && random32() % 1000 < fakes) {
+            s.push_back(PPRZ_STX);
+            s.push_back(PPRZ_MIN_LENGTH + random32() % (256 - PPRZ_MIN_LENGTH));
+        }
+        uint8_t length = 2 + random32() % 57;
+        for(uint8_t i = 0; i < length; i++) {
+            payload[i] = random32();
+        }
+        uint8_t l = pprz_pack(message, random32(), random32(), payload, length);
+        s.insert(s.end(), message, message + l);
+        (*messages)++;
+    }
+    for(size_t i = 0; i < s.size(); i++) {
+        if(random32() % 1000 < errors)
+            s[i] ^= 1 << (random32() % 8);
+    }
+    return s;
+}
+
+// the former parser: whole message check at the head, one byte dropped after an error
+static uint8_t rescan_parse(struct circularBuffer* cb) {
+    while(true) {
+        size_t fill = circularBuffer_fill(cb);
+        if(fill < 5)
+            return 0;
+        if(circularBuffer_peek(cb, 0) != PPRZ_STX) {
+            circularBuffer_read_element(cb);
+            continue;
+        }
+        uint8_t l = circularBuffer_peek(cb, 1);
+        if(l > fill)
+            return 0;
+        if(l <= 4) {
+            circularBuffer_read_element(cb);
+            continue;
+        }
+        uint8_t checksumA = 0;
+        uint8_t checksumB = 0;
+        for(size_t i = 1; i < l - 2u; i++) {
+            checksumA += circularBuffer_peek(cb, i);
+            checksumB += checksumA;
+        }
+        if(checksumA == circularBuffer_peek(cb, l - 2) && checksumB == circularBuffer_peek(cb, l - 1))
+            return l;
+        circularBuffer_read_element(cb);
+    }
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// runs the stream through a ring, a parse after every piece as the main loop
+// does after every UART burst. Returns the messages found
+static size_t run(const std::vector<uint8_t>& s, bool rescan, double* seconds) {
+    static uint8_t storage[2048];
+    struct circularBuffer cb;
+    circularBuffer_init(&cb, storage, sizeof(storage));
+    struct pprzParser parser;
+    pprzParser_init(&parser, 1);
+    size_t found = 0;
+    uint32_t pieces = 7;
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < s.size();) {
+        pieces = pieces * 1103515245 + 12345;
+        size_t n = 1 + (pieces >> 8) % 128;
+        if(n > s.size() - i)
+            n = s.size() - i;
+        circularBuffer_write(&cb, (uint8_t*)&s[i], n);
+        i += n;
+        if(rescan) {
+            uint8_t l;
+            while((l = rescan_parse(&cb))) {
+                circularBuffer_delete(&cb, l);
+                found++;
+            }
+            continue;
+        }
+        struct circularBufferSpan span[2];
+        struct pprzMessage m;
+        while(true) {
+            circularBuffer_read_spans(&cb, span);
+            int complete = pprzParser_next(&parser, span, &m);
+            circularBuffer_consume(&cb, m.offset + m.length);
+            if(!complete)
+                break;
+            found++;
+        }
+    }
+    *seconds = seconds_since(start);
+    return found;
+}
+
+int main(int argc, char** argv) {
+    size_t megabytes = 16;
+    unsigned errors = 0;
+    unsigned garbage = 0;
+    unsigned fakes = 0;
+    int opt;
+    while((opt = getopt(argc, argv, "m:e:g:f:s:")) != -1) {
+        switch(opt) {
+            case 'm': megabytes = atoi(optarg); break;
+            case 'e': errors = atoi(optarg); break;
+            case 'g': garbage = atoi(optarg); break;
+            case 'f': fakes = atoi(optarg); break;
+            case 's': seed = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-m MB] [-e errors] [-g garbage] [-f fakes] [-s seed]\n", argv[0]);
+                return 1;
+        }
+    }
+    size_t messages;
+    std::vector<uint8_t> s = stream(megabytes * 1000000, errors, garbage, fakes, &messages);
+    printf("%zu messages in %zu bytes, %u/1000 corrupted, %u/1000 garbage, %u/1000 fake STX\n",
+           messages, s.size(), errors, garbage, fakes);
+    double seconds;
+    size_t found = run(s, true, &seconds);
+    printf("%-16s %8.1f MB/s, %zu messages\n", "rescan", s.size() / seconds / 1e6, found);
+    size_t parsed = run(s, false, &seconds);
+    printf("%-16s %8.1f MB/s, %zu messages\n", "pprzParser", s.size() / seconds / 1e6, parsed);
+    if(!errors && !garbage && !fakes && parsed != messages) {
+        fprintf(stderr, "%zu of %zu messages parsed\n", parsed, messages);
+        return 1;
+    }
+    // both go on after the STX of a broken message
+    if(parsed < found) {
+        fprintf(stderr, "%zu messages parsed, the former parser finds %zu\n", parsed, found);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,178 @@
+/*
+ * Host benchmark and stress run of the ring buffers (circular_buffer.c and
+ * spsc_ring.h).
+ *
+ * The benchmark pushes messages through each buffer in one thread, the
+ * stress run has a producer and a consumer thread per full policy and checks
+ * that every byte arrives in order (DROP_OLD: at least in order within
+ * each read). Exits with 1 on a mismatch.
+ *
+ * Usage: ring_bench [-m MB] [-b message bytes] [-s stress MB]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "../spsc_ring.h"
+
+static const uint32_t RING_SIZE = 1024;
+// stream pattern, a prime so it doesn't line up with the ring
+static const uint32_t PATTERN = 251;
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void report(const char* name, size_t bytes, double seconds) {
+    printf("%-34s %8.1f MB/s\n", name, bytes / seconds / 1e6);
+}
+
+// the firmware path before the span API: element by element
+static void bench_elements(size_t total, size_t message) {
+    static uint8_t storage[RING_SIZE];
+    struct circularBuffer cb;
+    circularBuffer_init(&cb, storage, sizeof(storage));
+    std::vector<uint8_t> in(message, 0x55), out(message);
+    auto start = std::chrono::steady_clock::now();
+    for(size_t done = 0; done < total; done += message) {
+        for(size_t i = 0; i < message; i++) {
+            circularBuffer_write_element(&cb, in[i]);
+        }
+        for(size_t i = 0; i < message; i++) {
+            out[i] = circularBuffer_read_element(&cb);
+        }
+    }
+    report("circularBuffer per byte", total, seconds_since(start));
+}
+
+static void bench_circular(size_t total, size_t message) {
+    static uint8_t storage[RING_SIZE];
+    struct circularBuffer cb;
+    circularBuffer_init(&cb, storage, sizeof(storage));
+    std::vector<uint8_t> in(message, 0x55), out(message);
+    auto start = std::chrono::steady_clock::now();
+    for(size_t done = 0; done < total; done += message) {
+        circularBuffer_write(&cb, in.data(), message);
+        struct circularBufferSpan span[2];
+        circularBuffer_read_spans(&cb, span);
+        size_t first = message < span[0].length ? message : span[0].length;
+        memcpy(out.data(), span[0].data, first);
+        memcpy(out.data() + first, span[1].data, message - first);
+        circularBuffer_consume(&cb, message);
+    }
+    report("circularBuffer write/spans", total, seconds_since(start));
+}
+
+static void bench_spsc(size_t total, size_t message) {
+    static SpscRing<RING_SIZE> ring;
+    std::vector<uint8_t> in(message, 0x55), out(message);
+    auto start = std::chrono::steady_clock::now();
+    for(size_t done = 0; done < total; done += message) {
+        ring.write(in.data(), message);
+        ring.read(out.data(), message);
+    }
+    report("SpscRing write/read", total, seconds_since(start));
+}
+
+// producer and consumer thread, random chunks of up to 300 bytes
+template<SpscFullPolicy policy> static bool stress(const char* name, size_t total) {
+    static SpscRing<RING_SIZE, policy> ring;
+    std::atomic<bool> done(false);
+    std::thread producer([&]() {
+        uint8_t chunk[300];
+        uint32_t seed = 1;
+        uint32_t position = 0;
+        while(position < total) {
+            seed = seed * 1103515245 + 12345;
+            uint32_t n = 1 + (seed >> 16) % sizeof(chunk);
+            if(n > total - position)
+                n = total - position;
+            for(uint32_t i = 0; i < n; i++) {
+                chunk[i] = (position + i) % PATTERN;
+            }
+            // DROP_NEW: try again until there is room, nothing is lost but the
+            // failed attempts count as dropped
+            while(!ring.write(chunk, n)) {
+                std::this_thread::yield();
+            }
+            position += n;
+            // DROP_OLD: let the consumer in now and then, also on a single core
+            if(policy == SPSC_DROP_OLD && (seed >> 8) % 4 == 0)
+                std::this_thread::yield();
+        }
+        done = true;
+    });
+    uint8_t chunk[512];
+    size_t received = 0;
+    uint32_t expected = 0;
+    bool ok = true;
+    uint32_t seed = 7;
+    while(true) {
+        bool finished = done;
+        seed = seed * 1103515245 + 12345;
+        uint32_t n = ring.read(chunk, 1 + (seed >> 16) % sizeof(chunk));
+        if(n == 0) {
+            if(finished && ring.fill() == 0)
+                break;
+            std::this_thread::yield();
+            continue;
+        }
+        if(policy == SPSC_DROP_OLD)
+            expected = chunk[0];
+        for(uint32_t i = 0; i < n && ok; i++) {
+            if(chunk[i] != expected) {
+                fprintf(stderr, "%s: byte %zu is %u instead of %u\n", name, received + i, chunk[i], expected);
+                ok = false;
+            }
+            expected = (expected + 1) % PATTERN;
+        }
+        received += n;
+        // slow consumer phases, the ring runs full
+        if(policy != SPSC_DROP_NEW && (seed >> 8) % 64 == 0)
+            usleep(50);
+    }
+    producer.join();
+    if(policy != SPSC_DROP_OLD && received != total) {
+        fprintf(stderr, "%s: %zu of %zu bytes received\n", name, received, total);
+        ok = false;
+    }
+    printf("%-34s %s, %zu bytes, %u dropped\n", name, ok ? "ok" : "FAILED", received, (unsigned)ring.dropped());
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    size_t megabytes = 256;
+    size_t message = 24;
+    size_t stressMegabytes = 32;
+    int opt;
+    while((opt = getopt(argc, argv, "m:b:s:")) != -1) {
+        switch(opt) {
+            case 'm': megabytes = atoi(optarg); break;
+            case 'b': message = atoi(optarg); break;
+            case 's': stressMegabytes = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-m MB] [-b message bytes] [-s stress MB]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(message < 1 || message > RING_SIZE / 2) {
+        fprintf(stderr, "messages need 1..%u bytes\n", RING_SIZE / 2);
+        return 1;
+    }
+    size_t total = megabytes * 1000000 / message * message;
+    printf("%zu MB in messages of %zu bytes, ring of %u bytes\n", megabytes, message, RING_SIZE);
+    bench_elements(total, message);
+    bench_circular(total, message);
+    bench_spsc(total, message);
+
+    size_t stressTotal = stressMegabytes * 1000000;
+    bool ok = stress<SPSC_DROP_NEW>("stress DROP_NEW", stressTotal);
+    ok = stress<SPSC_BLOCK>("stress BLOCK", stressTotal) && ok;
+    ok = stress<SPSC_DROP_OLD>("stress DROP_OLD", stressTotal) && ok;
+    return ok ? 0 : 1;
+}
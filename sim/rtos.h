@@ -0,0 +1 @@
+// host simulation: everything needed lives in mbed.h
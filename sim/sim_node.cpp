@@ -0,0 +1,92 @@
+/*
+ * Glue of one firmware instance: entry points for the simulator and the
+ * storage behind the mbed stand-ins.
+ */
+#include "mbed.h"
+#include "sim_node.h"
+
+void setup();
+void loop();
+
+const struct simHost* simHost;
+uint8_t sim_node_addr;
+
+namespace sim {
+std::vector<PeriodicCall>& periodic() {
+    static std::vector<PeriodicCall> calls;
+    return calls;
+}
+std::deque<std::function<void()> >& deferred() {
+    static std::deque<std::function<void()> > calls;
+    return calls;
+}
+std::function<void()> irqHandler;
+}
+
+extern "C" {
+
+void sim_node_start(const struct simHost* host, uint8_t addr) {
+    simHost = host;
+    sim_node_addr = addr;
+    setup();
+}
+
+void sim_node_loop(void) {
+    loop();
+}
+
+void sim_node_irq(void) {
+    if(sim::irqHandler)
+        sim::irqHandler();
+}
+
+void sim_node_tx_done(uint64_t txStamp) {
+    simRadio.txStamp = txStamp;
+    simRadio.txDone = true;
+}
+
+void sim_node_rx(const uint8_t* data, unsigned int length, uint64_t rxStamp, float rxPower, float fpPower) {
+    if(length > sizeof(simRadio.rx))
+        length = sizeof(simRadio.rx);
+    memcpy(simRadio.rx, data, length);
+    simRadio.rxLength = length;
+    simRadio.rxStamp = rxStamp;
+    simRadio.rxPower = rxPower;
+    simRadio.fpPower = fpPower;
+    simRadio.rxDone = true;
+}
+
+void sim_node_rx_failed(void) {
+    simRadio.rxFailed = true;
+}
+
+void sim_node_uart_rx(int port, const uint8_t* data, unsigned int length) {
+    RawSerial* serial = RawSerial::port_at(port);
+    if(serial)
+        serial->receive(data, length);
+}
+
+int sim_node_timer_count(void) {
+    return (int)sim::periodic().size();
+}
+
+int sim_node_timer_period_ms(int timer) {
+    return sim::periodic()[timer].period_ms;
+}
+
+void sim_node_timer_fire(int timer) {
+    sim::periodic()[timer].fn();
+}
+
+int sim_node_run_deferred(void) {
+    int n = 0;
+    while(!sim::deferred().empty()) {
+        std::function<void()> fn = sim::deferred().front();
+        sim::deferred().pop_front();
+        fn();
+        n++;
+    }
+    return n;
+}
+
+}
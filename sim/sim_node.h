@@ -0,0 +1,70 @@
+#ifndef __sim_node_h
+#define __sim_node_h
+/*
+ * Interface between the simulator (uwb_sim.cpp) and one firmware instance.
+ * Every node is a separate copy of node.so, so all globals of main.cpp exist
+ * once per node. The firmware reaches the virtual radio and UARTs through
+ * simHost, the simulator drives the firmware through the sim_node_* calls.
+ */
+#include "inttypes.h"
+#include "stddef.h"
+#include "stdbool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct simHost {
+    void* node;
+    // local time of the node in us (skewed clock)
+    uint32_t (*micros)(void* node);
+    // local DW1000 system time in device ticks (40 bit)
+    uint64_t (*device_time)(void* node);
+    void (*radio_idle)(void* node);
+    void (*radio_receive)(void* node);
+    // txTime is only valid if delayed is set (device ticks)
+    void (*radio_transmit)(void* node, const uint8_t* data, unsigned int length, bool delayed, uint64_t txTime);
+    void (*uart_putc)(void* node, int port, uint8_t c);
+};
+
+extern const struct simHost* simHost;
+// replaces ADDR in main.cpp (-DADDR=sim_node_addr)
+extern uint8_t sim_node_addr;
+
+// entry points used by the simulator, resolved with dlsym
+void sim_node_start(const struct simHost* host, uint8_t addr);
+void sim_node_loop(void);
+void sim_node_irq(void);
+void sim_node_tx_done(uint64_t txStamp);
+void sim_node_rx(const uint8_t* data, unsigned int length, uint64_t rxStamp, float rxPower, float fpPower);
+void sim_node_rx_failed(void);
+void sim_node_uart_rx(int port, const uint8_t* data, unsigned int length);
+int sim_node_timer_count(void);
+int sim_node_timer_period_ms(int timer);
+void sim_node_timer_fire(int timer);
+// run work queued with EventQueue::call, returns the number of calls run
+int sim_node_run_deferred(void);
+
+// state of the virtual DW1000, shared between dw1000_sim.c and sim_node.cpp
+struct simRadio {
+    uint8_t tx[1024];
+    unsigned int txLength;
+    bool txDelayed;
+    uint64_t txTime;
+    uint8_t rx[1024];
+    unsigned int rxLength;
+    uint64_t txStamp;
+    uint64_t rxStamp;
+    float rxPower;
+    float fpPower;
+    bool txDone;
+    bool rxDone;
+    bool rxFailed;
+};
+extern struct simRadio simRadio;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // include guard
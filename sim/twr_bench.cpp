@@ -0,0 +1,153 @@
+/*
+ * Host comparison of the ranging protocols (ranging.cpp, clock_drift.cpp)
+ * with a responder clock that runs off the initiator's.
+ *
+ * Every exchange uses the firmware formulas on 40 bit timestamps with
+ * gaussian noise. The responder answers after the reply time in its own
+ * clock, exchanges follow each other every interval. MAGIC_RANGE_OFFSET is
+ * modelled as part of the propagation, as the antenna delays on hardware.
+ * For each offset it prints bias and standard deviation of DS-TWR,
+ * single-sided TWR with the rate from the drift table, and the bias of
+ * single-sided TWR without compensation.
+ *
+ * Usage: twr_bench [-d metres] [-x exchanges] [-s seed]
+ */
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "../ranging.h"
+#include "../clock_drift.h"
+
+// standard deviation of a timestamp
+static const double NOISE_S = 0.15e-9;
+static const double REPLY_S = 1e-3;
+static const double INTERVAL_S = 3e-3;
+static const uint8_t PEER = 2;
+
+static uint32_t seed = 1;
+
+static double uniform() {
+    seed = seed * 1103515245 + 12345;
+    return ((seed >> 8) + 0.5) / (1 << 24);
+}
+
+static double gaussian() {
+    return sqrt(-2 * log(uniform())) * cos(2 * M_PI * uniform());
+}
+
+// a clock with its rate relative to true time, timestamps in ticks
+struct clock {
+    double rate;
+    double offset;
+};
+
+static uint64_t stamp(const struct clock* c, double t) {
+    double ticks = (t * c->rate + c->offset + NOISE_S * gaussian()) * tsfreq;
+    return (uint64_t)llround(ticks) & 0xFFFFFFFFFFULL;
+}
+
+static uint64_t delta(uint64_t start, uint64_t end) {
+    dwTime_t s = {.full = start};
+    dwTime_t e = {.full = end};
+    uint64_t result;
+    calculateDeltaTime(&s, &e, &result);
+    return result;
+}
+
+struct stats {
+    double sum;
+    double squares;
+    unsigned n;
+};
+
+static void add(struct stats* s, double error) {
+    s->sum += error;
+    s->squares += error * error;
+    s->n++;
+}
+
+static double mean(const struct stats* s) {
+    return s->n ? s->sum / s->n : 0;
+}
+
+static double deviation(const struct stats* s) {
+    double m = mean(s);
+    return s->n > 1 ? sqrt((s->squares - s->n * m * m) / (s->n - 1)) : 0;
+}
+
+int main(int argc, char** argv) {
+    double distance = 10;
+    unsigned exchanges = 2000;
+    int opt;
+    while((opt = getopt(argc, argv, "d:x:s:")) != -1) {
+        switch(opt) {
+            case 'd': distance = atof(optarg); break;
+            case 'x': exchanges = atoi(optarg); break;
+            case 's': seed = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-d metres] [-x exchanges] [-s seed]\n", argv[0]);
+                return 1;
+        }
+    }
+    // exchanges have to stay within one wrap of the 40 bit counter (17 s)
+    if(exchanges < 1 || exchanges * INTERVAL_S > 15) {
+        fprintf(stderr, "exchanges need 1..%u\n", (unsigned)(15 / INTERVAL_S));
+        return 1;
+    }
+    double tof = (distance + MAGIC_RANGE_OFFSET) / speedOfLight;
+    printf("%.1f m, %.2f ns timestamp noise, %.0f ms reply, %.0f ms interval, %u exchanges\n",
+           distance, NOISE_S * 1e9, REPLY_S * 1e3, INTERVAL_S * 1e3, exchanges);
+    printf("offset   DS-TWR bias/std   SS+drift bias/std   SS uncompensated bias\n");
+    static const double offsets[] = {0, 5, 20, 40};
+    bool ok = true;
+    for(size_t o = 0; o < sizeof(offsets) / sizeof(offsets[0]); o++) {
+        struct clock initiator = {1.0, 0.001};
+        struct clock responder = {1.0 + offsets[o] * 1e-6, 0.002};
+        struct stats ds = {0, 0, 0};
+        struct stats ss = {0, 0, 0};
+        struct stats raw = {0, 0, 0};
+        drift_init();
+        for(unsigned i = 0; i < exchanges; i++) {
+            double t = i * INTERVAL_S;
+            // DS-TWR: RANGE_0, RANGE_1 after the reply time, RANGE_2 after the reply time
+            uint64_t pollTx = stamp(&initiator, t);
+            double tPollRx = t + tof;
+            uint64_t pollRx = stamp(&responder, tPollRx);
+            double tRespTx = tPollRx + REPLY_S / responder.rate;
+            uint64_t respTx = stamp(&responder, tRespTx);
+            uint64_t respRx = stamp(&initiator, tRespTx + tof);
+            double tFinalTx = tRespTx + tof + REPLY_S;
+            uint64_t finalTx = stamp(&initiator, tFinalTx);
+            uint64_t finalRx = stamp(&responder, tFinalTx + tof);
+            uint64_t round1 = delta(pollTx, respRx);
+            uint64_t reply1 = delta(pollRx, respTx);
+            uint64_t reply2 = delta(respRx, finalTx);
+            uint64_t round2 = delta(respTx, finalRx);
+            double prop;
+            calculatePropagationFormula(round1, reply1, round2, reply2, prop);
+            add(&ds, calculateDistanceFromTicks(prop) - distance);
+
+            // SS-TWR: the responder's tx timestamp feeds the drift table as in receive_ss_response
+            dwTime_t local = {.full = respRx};
+            dwTime_t remote = {.full = respTx};
+            drift_update_from_timestamps(PEER, &local, &remote);
+            calculateSingleSidedPropagation(round1, reply1, 1.0, prop);
+            add(&raw, calculateDistanceFromTicks(prop) - distance);
+            double rate;
+            if(drift_get_rate(PEER, &rate)) {
+                calculateSingleSidedPropagation(round1, reply1, rate, prop);
+                add(&ss, calculateDistanceFromTicks(prop) - distance);
+            }
+        }
+        printf("%3.0f ppm   %6.2f/%.2f cm    %6.2f/%.2f cm       %8.1f cm\n", offsets[o],
+               mean(&ds) * 100, deviation(&ds) * 100, mean(&ss) * 100, deviation(&ss) * 100, mean(&raw) * 100);
+        // the drift compensation has to take out the offset
+        if(fabs(mean(&ss) - mean(&ds)) > 0.05)
+            ok = false;
+    }
+    if(!ok)
+        fprintf(stderr, "single-sided bias off by more than 5 cm\n");
+    return ok ? 0 : 1;
+}
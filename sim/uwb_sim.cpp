@@ -0,0 +1,794 @@
+/*
+ * Discrete-event simulation of a swarm of ranging/telemetry nodes.
+ *
+ * Every node runs its own copy of the firmware (node.so: main.cpp and the
+ * modules next to it, built against the stand-ins in this directory). The
+ * nodes share a virtual UWB channel with airtime, propagation delay,
+ * collisions (no capture) and half duplex radios. Each node has its own
+ * clock offset and skew, which ends up in the DW1000 timestamps it sees, and
+ * flies straight at a constant velocity.
+ * Each autopilot feeds PPRZ telemetry into its node's UART.
+ *
+ * Usage: uwb_sim [-n 2,5,10,20,50] [-t seconds] [-s seed] [-r msg/s] [-b bytes] [-p 1|2|3] [-d] [-v] [-u prefix]
+ *
+ * -p 2 frames the telemetry of the autopilots as pprzlink 2.0 broadcasts, -p 3
+ * mixes the versions (odd addresses v1, even ones v2), -d frames it as
+ * pprzlink 2.0 messages to the autopilot of the next node
+ *
+ * -u writes the debug UART of every node to <prefix><N>_<addr>.bin, e.g. for
+ * Testing/cir_decode.py
+ *
+ * The same seed always gives the same result.
+ */
+#include <dlfcn.h>
+#include <unistd.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <queue>
+#include <string>
+#include <vector>
+#include "sim_node.h"
+
+// DW1000 timestamp counter
+static const double TICK_FREQ = 499.2e6 * 128;
+static const uint64_t TICK_MASK = 0xFFFFFFFFFFULL;
+static const double SPEED_OF_LIGHT = 299792458.0;
+
+// MODE_SHORTDATA_MID_ACCURACY: 850 kbps, PRF 64 MHz, 128 symbol preamble
+static const double PREAMBLE_S = 128 * 1.01763e-6;
+static const double SFD_S = 16 * 1.01763e-6;
+static const double PHR_S = 21 * 1.02564e-6;
+// payload bit incl. Reed-Solomon overhead (48 parity bits per 330 data bits)
+static const double BIT_S = 1.0 / 850e3 * (378.0 / 330.0);
+
+// time from a firmware command to the radio acting on it (SPI transfers)
+static const double TX_LATENCY_S = 60e-6;
+// time from a radio event to the firmware handler running
+static const double IRQ_LATENCY_S = 30e-6;
+// main loop spin period
+static const double LOOP_PERIOD_S = 200e-6;
+// standard deviation of a receive timestamp
+static const double TIMESTAMP_NOISE_S = 0.15e-9;
+static const double MAX_CLOCK_SKEW = 20e-6;
+static const double AREA_M = 50.0;
+// nodes fly straight at up to this horizontal speed (m/s)
+static const double MAX_SPEED = 3.0;
+static const double RADIO_RANGE_M = 300.0;
+// share of links without line of sight, their first path arrives late and attenuated
+static const double NLOS_LINKS = 0.2;
+static const double NLOS_MAX_EXCESS_M = 1.5;
+static const float NLOS_FP_LOSS_DB = 12.0f;
+
+// message id of the telemetry the simulated autopilots send
+static const uint8_t SIM_MSG_ID = 1;
+
+enum EventType { TIMER, LOOP, IRQ, TX_START, TX_END, RX_START, RX_END, TELEMETRY };
+
+struct Event {
+    double time;
+    uint64_t seq;
+    EventType type;
+    int node;
+    int arg;
+    bool operator<(const Event& other) const {
+        if(time != other.time)
+            return time > other.time;
+        return seq > other.seq;
+    }
+};
+
+struct NodeApi {
+    void* handle;
+    void (*start)(const struct simHost*, uint8_t);
+    void (*loop)(void);
+    void (*irq)(void);
+    void (*tx_done)(uint64_t);
+    void (*rx)(const uint8_t*, unsigned int, uint64_t, float, float);
+    void (*rx_failed)(void);
+    void (*uart_rx)(int, const uint8_t*, unsigned int);
+    int (*timer_count)(void);
+    int (*timer_period_ms)(int);
+    void (*timer_fire)(int);
+    int (*run_deferred)(void);
+};
+
+struct Transmission {
+    int node;
+    std::vector<uint8_t> data;
+    double start;
+    double end;
+    bool started;
+    bool aborted;
+};
+
+struct Reception {
+    int tx;
+    int node;
+    double start;
+    double end;
+    bool corrupted;
+};
+
+enum RadioMode { RADIO_IDLE, RADIO_RX, RADIO_TX };
+
+// PPRZ v1 stream parser for the UART output of a node
+struct PprzStream {
+    std::vector<uint8_t> message;
+    void push(uint8_t c) {
+        if(message.empty() && c != 0x99)
+            return;
+        message.push_back(c);
+        if(message.size() >= 2 && (message[1] < 6 || message.size() > message[1])) {
+            message.clear();
+            return;
+        }
+    }
+    bool complete() const {
+        return message.size() >= 6 && message.size() == message[1];
+    }
+    bool valid() const {
+        uint8_t a = 0;
+        uint8_t b = 0;
+        for(size_t i = 1; i < message.size() - 2; i++) {
+            a += message[i];
+            b += a;
+        }
+        return a == message[message.size() - 2] && b == message[message.size() - 1];
+    }
+};
+
+struct Node {
+    NodeApi api;
+    struct simHost host;
+    uint8_t addr;
+    double x, y, z;
+    double vx, vy;
+    double skew;
+    double offset;
+    RadioMode mode;
+    int currentTx;
+    int locked;
+    std::vector<int> active;
+    PprzStream uart;
+    uint16_t telemetrySeq;
+    std::string debug;
+    FILE* debugFile;
+};
+
+struct Stats {
+    uint64_t frames;
+    uint64_t frameBytes;
+    uint64_t framesByType[256];
+    uint64_t receptions;
+    uint64_t collisions;
+    uint64_t lateTx;
+    uint64_t abortedTx;
+    uint64_t ranges;
+    uint64_t telemetrySent;
+    uint64_t telemetryDelivered;
+    uint64_t telemetryBytes;
+    uint64_t nlosRated;
+    uint64_t nlosCorrect;
+    std::vector<double> latency;
+    std::vector<double> syncError;
+    std::vector<double> rateError;
+};
+
+class Simulation;
+static Simulation* sim;
+
+class Simulation {
+public:
+    Simulation(const std::string& library, int n, uint64_t seed, double telemetryRate, int telemetryBytes, int pprzVersion, bool unicast, bool verbose,
+            const std::string& debugPrefix)
+        : telemetryRate(telemetryRate), telemetryBytes(telemetryBytes), pprzVersion(pprzVersion), unicast(unicast), verbose(verbose), eventSeq(0), now(0), current(0), rng(seed), stats() {
+        nodes.resize(n);
+        for(int i = 0; i < n; i++) {
+            Node& node = nodes[i];
+            node.addr = i + 1;
+            node.x = uniform() * AREA_M;
+            node.y = uniform() * AREA_M;
+            node.z = uniform() * 10.0;
+            node.vx = (uniform() * 2 - 1) * MAX_SPEED;
+            node.vy = (uniform() * 2 - 1) * MAX_SPEED;
+            node.skew = (uniform() * 2 - 1) * MAX_CLOCK_SKEW;
+            node.offset = uniform() * 10.0;
+            node.mode = RADIO_IDLE;
+            node.currentTx = -1;
+            node.locked = -1;
+            node.telemetrySeq = 0;
+            node.debugFile = 0;
+            if(!debugPrefix.empty()) {
+                char name[32];
+                snprintf(name, sizeof(name), "%d_%d.bin", n, node.addr);
+                node.debugFile = fopen((debugPrefix + name).c_str(), "wb");
+            }
+            load(node, library, i);
+        }
+        nlosExcess.assign(n * n, 0.0);
+        for(int a = 0; a < n; a++) {
+            for(int b = a + 1; b < n; b++) {
+                if(uniform() < NLOS_LINKS)
+                    nlosExcess[a * n + b] = nlosExcess[b * n + a] = 0.2 + uniform() * (NLOS_MAX_EXCESS_M - 0.2);
+            }
+        }
+    }
+
+    ~Simulation() {
+        for(size_t i = 0; i < nodes.size(); i++) {
+            dlclose(nodes[i].api.handle);
+            if(nodes[i].debugFile)
+                fclose(nodes[i].debugFile);
+        }
+    }
+
+    // boot all nodes, the host callbacks are only usable from here on
+    void start() {
+        sim = this;
+        for(size_t i = 0; i < nodes.size(); i++) {
+            current = i;
+            nodes[i].api.start(&nodes[i].host, nodes[i].addr);
+            nodes[i].api.run_deferred();
+            int timers = nodes[i].api.timer_count();
+            for(int t = 0; t < timers; t++) {
+                schedule(local_interval(i, nodes[i].api.timer_period_ms(t) * 1e-3) * (1 + uniform()), TIMER, i, t);
+            }
+            schedule(LOOP_PERIOD_S * uniform(), LOOP, i, 0);
+            if(telemetryRate > 0)
+                schedule(uniform() / telemetryRate, TELEMETRY, i, 0);
+        }
+    }
+
+    void run(double duration) {
+        while(!events.empty() && events.top().time <= duration) {
+            Event e = events.top();
+            events.pop();
+            now = e.time;
+            current = e.node;
+            handle(e);
+            nodes[e.node].api.run_deferred();
+        }
+        now = duration;
+    }
+
+    void report(double duration) {
+        std::vector<double> l = stats.latency;
+        std::sort(l.begin(), l.end());
+        double mean = 0;
+        for(size_t i = 0; i < l.size(); i++) {
+            mean += l[i];
+        }
+        mean = l.empty() ? 0 : mean / l.size();
+        double p95 = l.empty() ? 0 : l[(size_t)(l.size() * 0.95)];
+        double sync = 0;
+        for(size_t i = 0; i < stats.syncError.size(); i++) {
+            sync += stats.syncError[i];
+        }
+        sync = stats.syncError.empty() ? 0 : sync / stats.syncError.size();
+        double rate = 0;
+        for(size_t i = 0; i < stats.rateError.size(); i++) {
+            rate += stats.rateError[i] * stats.rateError[i];
+        }
+        rate = stats.rateError.empty() ? 0 : sqrt(rate / stats.rateError.size());
+        uint64_t expected = stats.telemetrySent * (unicast ? 1 : nodes.size() - 1);
+        printf("%4zu %9.0f %7.2f%% %9.1f %6.2f %9.2f %6.1f%% %8.2f %8.2f %6llu %8.2f %6.1f%% %9.2f\n",
+                nodes.size(),
+                stats.frames / duration,
+                stats.receptions ? 100.0 * stats.collisions / stats.receptions : 0.0,
+                stats.ranges / duration,
+                stats.ranges ? (double)(stats.framesByType[0] + stats.framesByType[1] + stats.framesByType[2] +
+                    stats.framesByType[4] + stats.framesByType[5] + stats.framesByType[7] + stats.framesByType[8] +
+                    stats.framesByType[9] + stats.framesByType[11] + stats.framesByType[12] +
+                    stats.framesByType[13] + stats.framesByType[14] + stats.framesByType[15]) / stats.ranges : 0.0,
+                stats.telemetryBytes / duration / 1000.0,
+                expected ? 100.0 * stats.telemetryDelivered / expected : 0.0,
+                mean * 1e3,
+                p95 * 1e3,
+                (unsigned long long)stats.lateTx,
+                sync,
+                stats.nlosRated ? 100.0 * stats.nlosCorrect / stats.nlosRated : 0.0,
+                rate);
+    }
+
+    // simHost callbacks, always for the node whose code is running
+    uint32_t micros(int i) {
+        return (uint32_t)(local_time(i, now) * 1e6);
+    }
+
+    uint64_t device_time(int i) {
+        return device_ticks(i, now) & TICK_MASK;
+    }
+
+    void radio_idle(int i) {
+        Node& node = nodes[i];
+        if(node.mode == RADIO_TX && node.currentTx >= 0) {
+            Transmission& tx = transmissions[node.currentTx];
+            if(!tx.aborted && now < tx.end) {
+                tx.aborted = true;
+                stats.abortedTx++;
+            }
+        }
+        node.mode = RADIO_IDLE;
+        node.currentTx = -1;
+        node.locked = -1;
+    }
+
+    void radio_receive(int i) {
+        Node& node = nodes[i];
+        if(node.mode == RADIO_TX)
+            return;
+        node.mode = RADIO_RX;
+        node.locked = -1;
+    }
+
+    void radio_transmit(int i, const uint8_t* data, unsigned int length, bool delayed, uint64_t txTime) {
+        Node& node = nodes[i];
+        radio_idle(i);
+        double start = now + TX_LATENCY_S;
+        if(delayed) {
+            // the rmarker leaves the antenna at txTime
+            uint64_t ticksNow = device_ticks(i, now);
+            uint64_t target = (ticksNow & ~TICK_MASK) | txTime;
+            if(target < ticksNow)
+                target += TICK_MASK + 1;
+            double marker = global_time(i, target / TICK_FREQ);
+            start = marker - PREAMBLE_S - SFD_S;
+            if(start < now + TX_LATENCY_S) {
+                // too late, the DW1000 waits for the counter to wrap
+                stats.lateTx++;
+                start += (TICK_MASK + 1) / TICK_FREQ;
+            }
+        }
+        Transmission tx;
+        tx.node = i;
+        tx.data.assign(data, data + length);
+        tx.start = start;
+        tx.end = start + airtime(length);
+        tx.started = false;
+        tx.aborted = false;
+        transmissions.push_back(tx);
+        node.currentTx = transmissions.size() - 1;
+        node.mode = RADIO_TX;
+        schedule(start, TX_START, i, node.currentTx);
+    }
+
+    void uart_putc(int i, int port, uint8_t c) {
+        Node& node = nodes[i];
+        if(port != 0) {
+            if(node.debugFile)
+                fputc(c, node.debugFile);
+            if(verbose) {
+                if(c == '\n') {
+                    printf("[%10.6f] node %u: %s\n", now, node.addr, node.debug.c_str());
+                    node.debug.clear();
+                } else if(c != '\r') {
+                    node.debug += (char)c;
+                }
+            }
+            return;
+        }
+        node.uart.push(c);
+        if(node.uart.complete()) {
+            if(node.uart.valid())
+                uart_message(i, node.uart.message);
+            node.uart.message.clear();
+        }
+    }
+
+private:
+    double uniform() {
+        return (rng() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    double gaussian() {
+        double u1 = uniform();
+        double u2 = uniform();
+        if(u1 < 1e-300)
+            u1 = 1e-300;
+        return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+    }
+
+    double local_time(int i, double t) {
+        return t * (1 + nodes[i].skew) + nodes[i].offset;
+    }
+
+    double global_time(int i, double local) {
+        return (local - nodes[i].offset) / (1 + nodes[i].skew);
+    }
+
+    double local_interval(int i, double interval) {
+        return interval / (1 + nodes[i].skew);
+    }
+
+    uint64_t device_ticks(int i, double t) {
+        return (uint64_t)(local_time(i, t) * TICK_FREQ);
+    }
+
+    double airtime(unsigned int length) {
+        // frame check sequence adds 2 bytes
+        return PREAMBLE_S + SFD_S + PHR_S + (length + 2) * 8 * BIT_S;
+    }
+
+    double distance(int a, int b) {
+        double dx = nodes[a].x - nodes[b].x + (nodes[a].vx - nodes[b].vx) * now;
+        double dy = nodes[a].y - nodes[b].y + (nodes[a].vy - nodes[b].vy) * now;
+        double dz = nodes[a].z - nodes[b].z;
+        return sqrt(dx * dx + dy * dy + dz * dz);
+    }
+
+    // true change of the distance between a and b right now (m/s)
+    double range_rate(int a, int b) {
+        double dx = nodes[a].x - nodes[b].x + (nodes[a].vx - nodes[b].vx) * now;
+        double dy = nodes[a].y - nodes[b].y + (nodes[a].vy - nodes[b].vy) * now;
+        double d = distance(a, b);
+        return d > 0 ? (dx * (nodes[a].vx - nodes[b].vx) + dy * (nodes[a].vy - nodes[b].vy)) / d : 0;
+    }
+
+    void schedule(double time, EventType type, int node, int arg) {
+        Event e = {time, eventSeq++, type, node, arg};
+        events.push(e);
+    }
+
+    void load(Node& node, const std::string& library, int index) {
+        // every node needs its own copy, dlopen would share one otherwise
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/uwb_sim_%d_%d.so", (int)getpid(), index);
+        std::string cmd = "cp '" + library + "' " + path;
+        if(system(cmd.c_str()) != 0) {
+            fprintf(stderr, "can't copy %s\n", library.c_str());
+            exit(1);
+        }
+        void* handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+        unlink(path);
+        if(!handle) {
+            fprintf(stderr, "%s\n", dlerror());
+            exit(1);
+        }
+        NodeApi& api = node.api;
+        api.handle = handle;
+        resolve(api.start, handle, "sim_node_start");
+        resolve(api.loop, handle, "sim_node_loop");
+        resolve(api.irq, handle, "sim_node_irq");
+        resolve(api.tx_done, handle, "sim_node_tx_done");
+        resolve(api.rx, handle, "sim_node_rx");
+        resolve(api.rx_failed, handle, "sim_node_rx_failed");
+        resolve(api.uart_rx, handle, "sim_node_uart_rx");
+        resolve(api.timer_count, handle, "sim_node_timer_count");
+        resolve(api.timer_period_ms, handle, "sim_node_timer_period_ms");
+        resolve(api.timer_fire, handle, "sim_node_timer_fire");
+        resolve(api.run_deferred, handle, "sim_node_run_deferred");
+        node.host.node = (void*)(intptr_t)index;
+        node.host.micros = host_micros;
+        node.host.device_time = host_device_time;
+        node.host.radio_idle = host_radio_idle;
+        node.host.radio_receive = host_radio_receive;
+        node.host.radio_transmit = host_radio_transmit;
+        node.host.uart_putc = host_uart_putc;
+    }
+
+    template<typename F> static void resolve(F& fn, void* handle, const char* name) {
+        void* s = dlsym(handle, name);
+        if(!s) {
+            fprintf(stderr, "missing %s in node library\n", name);
+            exit(1);
+        }
+        fn = reinterpret_cast<F>(s);
+    }
+
+    void handle(const Event& e) {
+        Node& node = nodes[e.node];
+        switch(e.type) {
+            case TIMER:
+                node.api.timer_fire(e.arg);
+                schedule(now + local_interval(e.node, node.api.timer_period_ms(e.arg) * 1e-3), TIMER, e.node, e.arg);
+                break;
+            case LOOP:
+                node.api.loop();
+                schedule(now + local_interval(e.node, LOOP_PERIOD_S), LOOP, e.node, 0);
+                break;
+            case IRQ:
+                node.api.irq();
+                break;
+            case TX_START:
+                tx_start(e.arg);
+                break;
+            case TX_END:
+                tx_end(e.arg);
+                break;
+            case RX_START:
+                rx_start(e.arg);
+                break;
+            case RX_END:
+                rx_end(e.arg);
+                break;
+            case TELEMETRY:
+                telemetry(e.node);
+                schedule(now + 1.0 / telemetryRate, TELEMETRY, e.node, 0);
+                break;
+        }
+    }
+
+    void tx_start(int t) {
+        Transmission& tx = transmissions[t];
+        if(tx.aborted || nodes[tx.node].currentTx != t)
+            return;
+        tx.started = true;
+        stats.frames++;
+        stats.frameBytes += tx.data.size();
+        if(tx.data.size() > 2)
+            stats.framesByType[tx.data[2]]++;
+        for(size_t j = 0; j < nodes.size(); j++) {
+            if((int)j == tx.node)
+                continue;
+            double d = distance(tx.node, j);
+            if(d > RADIO_RANGE_M)
+                continue;
+            Reception r = {t, (int)j, tx.start + d / SPEED_OF_LIGHT, tx.end + d / SPEED_OF_LIGHT, false};
+            receptions.push_back(r);
+            schedule(r.start, RX_START, j, receptions.size() - 1);
+            schedule(r.end, RX_END, j, receptions.size() - 1);
+        }
+        schedule(tx.end, TX_END, tx.node, t);
+    }
+
+    void tx_end(int t) {
+        Transmission& tx = transmissions[t];
+        Node& node = nodes[tx.node];
+        if(tx.aborted || node.currentTx != t)
+            return;
+        node.mode = RADIO_IDLE;
+        node.currentTx = -1;
+        double marker = tx.start + PREAMBLE_S + SFD_S;
+        node.api.tx_done(device_ticks(tx.node, marker) & TICK_MASK);
+        schedule(now + IRQ_LATENCY_S, IRQ, tx.node, 0);
+    }
+
+    void rx_start(int r) {
+        Reception& rx = receptions[r];
+        Node& node = nodes[rx.node];
+        // overlapping frames destroy each other, there is no capture effect
+        if(!node.active.empty()) {
+            rx.corrupted = true;
+            for(size_t k = 0; k < node.active.size(); k++) {
+                receptions[node.active[k]].corrupted = true;
+            }
+        }
+        node.active.push_back(r);
+        if(node.mode == RADIO_RX && node.locked < 0)
+            node.locked = r;
+    }
+
+    void rx_end(int r) {
+        Reception& rx = receptions[r];
+        Node& node = nodes[rx.node];
+        node.active.erase(std::find(node.active.begin(), node.active.end(), r));
+        if(node.locked != r)
+            return;
+        node.locked = -1;
+        if(node.mode != RADIO_RX)
+            return;
+        Transmission& tx = transmissions[rx.tx];
+        stats.receptions++;
+        node.mode = RADIO_IDLE;
+        if(rx.corrupted || tx.aborted) {
+            if(rx.corrupted)
+                stats.collisions++;
+            node.api.rx_failed();
+        } else {
+            double excess = nlosExcess[tx.node * nodes.size() + rx.node];
+            double marker = rx.start + PREAMBLE_S + SFD_S + gaussian() * TIMESTAMP_NOISE_S + excess / SPEED_OF_LIGHT;
+            double d = distance(tx.node, rx.node);
+            float power = -65.0f - 20.0f * log10(d < 1 ? 1 : d);
+            float fpPower = power - (excess > 0 ? NLOS_FP_LOSS_DB : 2.0f);
+            node.api.rx(tx.data.data(), tx.data.size(), device_ticks(rx.node, marker) & TICK_MASK, power, fpPower);
+        }
+        schedule(now + IRQ_LATENCY_S, IRQ, rx.node, 0);
+    }
+
+    // PPRZ version of the autopilot of node i
+    int autopilot_version(int i) const {
+        if(pprzVersion == 3)
+            return nodes[i].addr % 2 ? 1 : 2;
+        return pprzVersion;
+    }
+
+    void telemetry(int i) {
+        Node& node = nodes[i];
+        std::vector<uint8_t> m(telemetryBytes, 0);
+        m[0] = 0x99;
+        m[1] = telemetryBytes;
+        m[2] = node.addr;
+        int header = 4;
+        if(autopilot_version(i) == 2) {
+            // broadcast or the next node, telemetry class
+            m[3] = unicast ? node.addr % nodes.size() + 1 : 0;
+            m[4] = 1;
+            header = 6;
+        }
+        m[header - 1] = SIM_MSG_ID;
+        uint16_t seq = node.telemetrySeq++;
+        m[header] = seq & 0xFF;
+        m[header + 1] = seq >> 8;
+        uint8_t a = 0;
+        uint8_t b = 0;
+        for(int k = 1; k < telemetryBytes - 2; k++) {
+            a += m[k];
+            b += a;
+        }
+        m[telemetryBytes - 2] = a;
+        m[telemetryBytes - 1] = b;
+        sent[((uint32_t)node.addr << 16) | seq] = now;
+        stats.telemetrySent++;
+        node.api.uart_rx(0, m.data(), m.size());
+    }
+
+    void uart_message(int i, const std::vector<uint8_t>& m) {
+        uint8_t addr = nodes[i].addr;
+        // a v2 autopilot gets the bridge's own messages as v1 until the
+        // bridge has detected its framing
+        int version = autopilot_version(i);
+        size_t header = version == 2 ? 6 : 4;
+        if(m.size() < header + 2)
+            return;
+        uint8_t id = m[header - 1];
+        const uint8_t* payload = &m[header];
+        size_t length = m.size() - header - 2;
+        if(id == SIM_MSG_ID && length >= 2) {
+            std::map<uint32_t, double>::iterator it = sent.find(((uint32_t)m[2] << 16) | payload[0] | (payload[1] << 8));
+            if(it != sent.end() && m[2] != addr) {
+                // UART load, also of messages for another autopilot
+                stats.telemetryBytes += m.size();
+                if(version == 2 && m[3] != 0 && m[3] != addr)
+                    return;
+                stats.telemetryDelivered++;
+                stats.latency.push_back(now - it->second);
+            }
+        } else if((id == 254 || id == 252) && length >= 2) {
+            if(payload[0] == addr || payload[1] == addr)
+                stats.ranges++;
+        } else if(id == 246 && length >= 6 && length >= 7u + payload[5]) {
+            // RANGE_MATRIX, a pair is counted at its first member
+            uint8_t count = payload[5];
+            const uint8_t* ranges = payload + 7 + count;
+            for(int a = 0, k = 0; a < count; a++) {
+                for(int b = a + 1; b < count; b++, k++) {
+                    int16_t cm;
+                    if(ranges + 2 * k + 2 > payload + length)
+                        return;
+                    memcpy(&cm, ranges + 2 * k, 2);
+                    if(payload[6 + a] == addr && cm != INT16_MIN)
+                        stats.ranges++;
+                }
+            }
+        } else if(id == 248 && length >= 4 && addr != 1) {
+            // SWARM_TIME against the true clock of the reference (addr 1) right now
+            uint32_t swarm;
+            memcpy(&swarm, payload, 4);
+            uint32_t reference = (uint32_t)(uint64_t)(device_ticks(0, now) / (TICK_FREQ / 1e6));
+            stats.syncError.push_back(fabs((double)(int32_t)(swarm - reference)));
+        } else if(id == 253 && length >= 5) {
+            for(size_t k = 5; k + 12 <= length; k += 12) {
+                if(payload[k] != addr && payload[k + 1] != addr)
+                    continue;
+                stats.ranges++;
+                // rated NLOS likelihood (entry byte 7) against the true link state
+                int a = payload[k] - 1;
+                int b = payload[k + 1] - 1;
+                if(payload[k + 6] != 0 && a >= 0 && b >= 0 && a < (int)nodes.size() && b < (int)nodes.size()) {
+                    stats.nlosRated++;
+                    if((payload[k + 7] > 127) == (nlosExcess[a * nodes.size() + b] > 0))
+                        stats.nlosCorrect++;
+                }
+                // published range rate (bytes 8-9), 0 while unknown
+                int16_t rate;
+                memcpy(&rate, payload + k + 8, 2);
+                if(rate != 0 && a >= 0 && b >= 0 && a < (int)nodes.size() && b < (int)nodes.size())
+                    stats.rateError.push_back(rate / 1000.0 - range_rate(a, b));
+            }
+        }
+    }
+
+    static uint32_t host_micros(void* n) { return sim->micros((intptr_t)n); }
+    static uint64_t host_device_time(void* n) { return sim->device_time((intptr_t)n); }
+    static void host_radio_idle(void* n) { sim->radio_idle((intptr_t)n); }
+    static void host_radio_receive(void* n) { sim->radio_receive((intptr_t)n); }
+    static void host_radio_transmit(void* n, const uint8_t* data, unsigned int length, bool delayed, uint64_t txTime) {
+        sim->radio_transmit((intptr_t)n, data, length, delayed, txTime);
+    }
+    static void host_uart_putc(void* n, int port, uint8_t c) { sim->uart_putc((intptr_t)n, port, c); }
+
+    double telemetryRate;
+    int telemetryBytes;
+    int pprzVersion;
+    bool unicast;
+    bool verbose;
+    uint64_t eventSeq;
+    double now;
+    int current;
+    struct Xorshift {
+        uint64_t s;
+        Xorshift(uint64_t seed) : s(seed * 2685821657736338717ULL + 1) {}
+        uint64_t operator()() {
+            s ^= s >> 12;
+            s ^= s << 25;
+            s ^= s >> 27;
+            return s * 2685821657736338717ULL;
+        }
+    } rng;
+    std::vector<Node> nodes;
+    // extra path length of the first path per link (m), 0 for line of sight
+    std::vector<double> nlosExcess;
+    std::vector<Transmission> transmissions;
+    std::vector<Reception> receptions;
+    std::priority_queue<Event> events;
+    std::map<uint32_t, double> sent;
+    Stats stats;
+};
+
+int main(int argc, char** argv) {
+    std::vector<int> sizes;
+    double duration = 10.0;
+    uint64_t seed = 1;
+    double telemetryRate = 10.0;
+    int telemetryBytes = 20;
+    int pprzVersion = 1;
+    bool unicast = false;
+    bool verbose = false;
+    std::string library = "./node.so";
+    std::string debugPrefix;
+    int opt;
+    while((opt = getopt(argc, argv, "n:t:s:r:b:p:dl:vu:")) != -1) {
+        switch(opt) {
+            case 'n': {
+                char* p = optarg;
+                while(*p) {
+                    sizes.push_back(strtol(p, &p, 10));
+                    if(*p == ',')
+                        p++;
+                }
+                break;
+            }
+            case 't': duration = atof(optarg); break;
+            case 's': seed = strtoull(optarg, 0, 10); break;
+            case 'r': telemetryRate = atof(optarg); break;
+            case 'b': telemetryBytes = atoi(optarg); break;
+            case 'p': pprzVersion = atoi(optarg); break;
+            case 'd': unicast = true; pprzVersion = 2; break;
+            case 'l': library = optarg; break;
+            case 'v': verbose = true; break;
+            case 'u': debugPrefix = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-n 2,5,10] [-t seconds] [-s seed] [-r msg/s] [-b bytes] [-p 1|2|3] [-d] [-l node.so] [-v] [-u prefix]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(sizes.empty()) {
+        int defaults[] = {2, 5, 10, 20, 50};
+        sizes.assign(defaults, defaults + 5);
+    }
+    if(pprzVersion < 1 || pprzVersion > 3) {
+        fprintf(stderr, "PPRZ version 1, 2 or 3 (mixed)\n");
+        return 1;
+    }
+    int minBytes = pprzVersion == 1 ? 8 : 10;
+    if(telemetryBytes < minBytes || telemetryBytes > 255) {
+        fprintf(stderr, "telemetry messages need %d..255 bytes\n", minBytes);
+        return 1;
+    }
+    printf("seed %llu, %.1fs, telemetry %.1f msg/s of %d bytes per node, PPRZ %s%s\n",
+            (unsigned long long)seed, duration, telemetryRate, telemetryBytes,
+            pprzVersion == 3 ? "v1/v2 mixed" : pprzVersion == 2 ? "v2" : "v1", unicast ? " unicast" : "");
+    printf("   N  frames/s  collide  ranges/s  fr/rg  telem kB/s  deliv  lat ms  p95 ms   late  sync us  nlos ok  rate m/s\n");
+    for(size_t k = 0; k < sizes.size(); k++) {
+        Simulation s(library, sizes[k], seed + sizes[k], telemetryRate, telemetryBytes, pprzVersion, unicast, verbose, debugPrefix);
+        s.start();
+        s.run(duration);
+        s.report(duration);
+    }
+    return 0;
+}
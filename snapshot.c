@@ -0,0 +1,169 @@
+#include "snapshot.h"
+#include "string.h"
+
+#define DEVICE_MASK 0xFFFFFFFFFFULL
+
+static void report_clear(struct snapshotReport* r) {
+    r->valid = 0;
+    r->chainTx = SNAPSHOT_MISSING;
+    r->reportTx = SNAPSHOT_MISSING;
+    for(uint8_t i = 0; i < SNAPSHOT_MAX_NODES; i++) {
+        r->rxChain[i] = SNAPSHOT_MISSING;
+        r->rxReport[i] = SNAPSHOT_MISSING;
+    }
+}
+
+// ticks since the slot 0 frame, the device time wraps after 2^40 ticks
+static int32_t offset(struct snapshot* s, uint64_t ticks) {
+    int64_t d = (int64_t)(((ticks - s->reference) & DEVICE_MASK) << 24) >> 24;
+    if(d <= SNAPSHOT_MISSING || d > INT32_MAX)
+        return SNAPSHOT_MISSING;
+    return (int32_t)d;
+}
+
+static void put32(uint8_t* p, int32_t value) {
+    memcpy(p, &value, sizeof(value));
+}
+
+static int32_t get32(const uint8_t* p) {
+    int32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static void seen(struct snapshot* s, uint8_t slot, uint32_t now) {
+    s->lastSlot = slot;
+    s->skipped = 0;
+    s->lastFrame = now;
+}
+
+void snapshot_init(struct snapshot* s) {
+    s->active = 0;
+    s->count = 0;
+    s->self = SNAPSHOT_NO_SLOT;
+}
+
+void snapshot_start(struct snapshot* s, uint8_t round, const uint8_t* members, uint8_t count,
+        uint8_t self, uint64_t ticks, uint32_t now) {
+    if(count > SNAPSHOT_MAX_NODES)
+        count = SNAPSHOT_MAX_NODES;
+    s->active = 1;
+    s->round = round;
+    s->count = count;
+    s->self = SNAPSHOT_NO_SLOT;
+    s->reference = ticks;
+    for(uint8_t i = 0; i < count; i++) {
+        s->members[i] = members[i];
+        if(members[i] == self)
+            s->self = i;
+        report_clear(&s->reports[i]);
+    }
+    if(s->self != SNAPSHOT_NO_SLOT)
+        s->reports[s->self].valid = 1;
+    seen(s, 0, now);
+}
+
+uint8_t snapshot_slots(struct snapshot* s) {
+    return 2 * s->count;
+}
+
+void snapshot_rx(struct snapshot* s, uint8_t slot, uint64_t ticks, uint32_t now) {
+    if(!s->active || slot >= snapshot_slots(s))
+        return;
+    seen(s, slot, now);
+    if(s->self == SNAPSHOT_NO_SLOT)
+        return;
+    struct snapshotReport* own = &s->reports[s->self];
+    if(slot < s->count)
+        own->rxChain[slot] = offset(s, ticks);
+    else
+        own->rxReport[slot - s->count] = offset(s, ticks);
+}
+
+void snapshot_tx(struct snapshot* s, uint8_t slot, uint64_t ticks, uint32_t now) {
+    if(!s->active || s->self == SNAPSHOT_NO_SLOT || slot >= snapshot_slots(s))
+        return;
+    // the leader's own slot 0 frame is its reference
+    if(slot == 0)
+        s->reference = ticks;
+    seen(s, slot, now);
+    struct snapshotReport* own = &s->reports[s->self];
+    if(slot < s->count)
+        own->chainTx = offset(s, ticks);
+    else
+        own->reportTx = offset(s, ticks);
+}
+
+void snapshot_report(struct snapshot* s, uint8_t slot, const uint8_t* data, size_t length) {
+    if(!s->active || slot < s->count || slot >= snapshot_slots(s))
+        return;
+    if(length < (size_t)SNAPSHOT_REPORT_SIZE(s->count))
+        return;
+    struct snapshotReport* r = &s->reports[slot - s->count];
+    r->chainTx = get32(data);
+    r->reportTx = get32(data + 4);
+    for(uint8_t i = 0; i < s->count; i++) {
+        r->rxChain[i] = get32(data + 8 + 4 * i);
+        r->rxReport[i] = get32(data + 8 + 4 * (s->count + i));
+    }
+    r->valid = 1;
+}
+
+uint8_t snapshot_next(struct snapshot* s) {
+    if(!s->active || s->self == SNAPSHOT_NO_SLOT)
+        return SNAPSHOT_NO_SLOT;
+    uint16_t next = s->lastSlot + 1 + s->skipped;
+    if(next == s->self || next == s->self + s->count)
+        return next;
+    return SNAPSHOT_NO_SLOT;
+}
+
+int snapshot_stalled(struct snapshot* s, uint32_t now, uint32_t timeout) {
+    if(!s->active)
+        return 0;
+    if(now - s->lastFrame > timeout) {
+        s->skipped++;
+        s->lastFrame = now;
+    }
+    if(s->lastSlot + 1 + s->skipped >= snapshot_slots(s))
+        s->active = 0;
+    return s->active;
+}
+
+int snapshot_complete(struct snapshot* s) {
+    return s->count && s->lastSlot + 1 >= snapshot_slots(s);
+}
+
+uint8_t snapshot_pack(struct snapshot* s, uint8_t* out) {
+    struct snapshotReport* own = &s->reports[s->self];
+    put32(out, own->chainTx);
+    put32(out + 4, own->reportTx);
+    for(uint8_t i = 0; i < s->count; i++) {
+        put32(out + 8 + 4 * i, own->rxChain[i]);
+        put32(out + 8 + 4 * (s->count + i), own->rxReport[i]);
+    }
+    return SNAPSHOT_REPORT_SIZE(s->count);
+}
+
+double snapshot_propagation(struct snapshot* s, uint8_t a, uint8_t b) {
+    if(a > b) {
+        uint8_t t = a;
+        a = b;
+        b = t;
+    }
+    struct snapshotReport* ra = &s->reports[a];
+    struct snapshotReport* rb = &s->reports[b];
+    if(a == b || !ra->valid || !rb->valid)
+        return -1;
+    if(ra->chainTx == SNAPSHOT_MISSING || ra->reportTx == SNAPSHOT_MISSING || ra->rxChain[b] == SNAPSHOT_MISSING
+            || rb->chainTx == SNAPSHOT_MISSING || rb->rxChain[a] == SNAPSHOT_MISSING || rb->rxReport[a] == SNAPSHOT_MISSING)
+        return -1;
+    // chain a -> chain b -> report a, as RANGE_0, RANGE_1, RANGE_2
+    double round1 = (double)ra->rxChain[b] - ra->chainTx;
+    double reply1 = (double)rb->chainTx - rb->rxChain[a];
+    double round2 = (double)rb->rxReport[a] - rb->chainTx;
+    double reply2 = (double)ra->reportTx - ra->rxChain[b];
+    if(round1 <= 0 || reply1 <= 0 || round2 <= 0 || reply2 <= 0)
+        return -1;
+    return (round1 * round2 - reply1 * reply2) / (round1 + reply1 + round2 + reply2);
+}
@@ -0,0 +1,71 @@
+#ifndef __snapshot_h
+#define __snapshot_h
+
+#include "inttypes.h"
+#include "stddef.h"
+
+/*
+ * Snapshot ranging round: the leader sends the member list in slot 0, then
+ * every member answers the frame of the slot before its own, so each frame
+ * is the response to the previous one and the poll for the next. Slots
+ * 0..n-1 are these chain frames, slots n..2n-1 one timestamp report per
+ * member in the same order. Any pair a before b then has the frames
+ * chain a, chain b, report a: an asymmetric DS-TWR exchange, and every node
+ * that heard all reports can compute the whole range matrix of the round.
+ */
+// a report (8 + 8 * n bytes) has to fit into a standard frame
+#define SNAPSHOT_MAX_NODES 12
+#define SNAPSHOT_MAX_PAIRS (SNAPSHOT_MAX_NODES * (SNAPSHOT_MAX_NODES - 1) / 2)
+#define SNAPSHOT_REPORT_SIZE(n) (8 + 8 * (n))
+#define SNAPSHOT_NO_SLOT 0xFF
+// timestamps are int32 offsets to the slot 0 frame, a round has to end within 33ms
+#define SNAPSHOT_MISSING INT32_MIN
+
+// timestamps of one member, in ticks of its own clock relative to its slot 0 frame
+struct snapshotReport {
+    uint8_t valid;
+    int32_t chainTx;
+    int32_t reportTx;
+    int32_t rxChain[SNAPSHOT_MAX_NODES];
+    int32_t rxReport[SNAPSHOT_MAX_NODES];
+};
+
+struct snapshot {
+    uint8_t active;
+    uint8_t round;
+    uint8_t count;
+    uint8_t members[SNAPSHOT_MAX_NODES];
+    uint8_t self;           // own index, SNAPSHOT_NO_SLOT if not a member
+    uint8_t lastSlot;       // last slot sent or heard
+    uint8_t skipped;        // silent slots after lastSlot given up on
+    uint32_t lastFrame;     // us
+    uint64_t reference;     // device time of the slot 0 frame
+    struct snapshotReport reports[SNAPSHOT_MAX_NODES];
+};
+
+void snapshot_init(struct snapshot* s);
+// a new round with count members, when the slot 0 frame is received or
+// (leader) about to be sent, its tx timestamp then replaces ticks
+void snapshot_start(struct snapshot* s, uint8_t round, const uint8_t* members, uint8_t count,
+        uint8_t self, uint64_t ticks, uint32_t now);
+uint8_t snapshot_slots(struct snapshot* s);
+
+// own device timestamps of the frames in slot
+void snapshot_rx(struct snapshot* s, uint8_t slot, uint64_t ticks, uint32_t now);
+void snapshot_tx(struct snapshot* s, uint8_t slot, uint64_t ticks, uint32_t now);
+// report of the member in slot
+void snapshot_report(struct snapshot* s, uint8_t slot, const uint8_t* data, size_t length);
+
+// own slot following the last one, SNAPSHOT_NO_SLOT if it's not this node's turn
+uint8_t snapshot_next(struct snapshot* s);
+// a slot stayed silent for too long: the member after it goes on, returns
+// 0 once the round is over
+int snapshot_stalled(struct snapshot* s, uint32_t now, uint32_t timeout);
+int snapshot_complete(struct snapshot* s);
+
+// own report into out (SNAPSHOT_REPORT_SIZE(count) bytes), returns its length
+uint8_t snapshot_pack(struct snapshot* s, uint8_t* out);
+// propagation time (ticks) between the members with index a and b, < 0 if unknown
+double snapshot_propagation(struct snapshot* s, uint8_t a, uint8_t b);
+
+#endif // include guard
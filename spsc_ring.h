@@ -0,0 +1,206 @@
+#ifndef __spsc_ring_h
+#define __spsc_ring_h
+
+#include "inttypes.h"
+#include "stddef.h"
+#include "string.h"
+extern "C" {
+#include "circular_buffer.h"
+}
+
+/*
+ * Lock-free byte ring for one producer and one consumer in different
+ * contexts (an interrupt and a thread, or two threads). head is written only
+ * by the producer, tail only by the consumer. Both count up freely and are
+ * masked with the capacity N, a power of two, so all N bytes are usable and
+ * there is no modulo. A release store of an index publishes the bytes
+ * before it, the acquire load on the other side makes them visible.
+ */
+enum SpscFullPolicy {
+    // a write that doesn't fit as a whole is dropped, messages stay complete
+    SPSC_DROP_NEW,
+    // writes never fail, the consumer skips what was overwritten. Bytes
+    // overwritten during a span access can be torn, only for checked data
+    SPSC_DROP_OLD,
+    // the producer waits for the consumer, never from an interrupt
+    SPSC_BLOCK
+};
+
+template<uint32_t N, SpscFullPolicy policy = SPSC_DROP_NEW>
+class SpscRing {
+    typedef char capacityIsPowerOfTwo[N && (N & (N - 1)) == 0 ? 1 : -1];
+public:
+    SpscRing() : head(0), tail(0), reserved(0), droppedNew(0), skippedOld(0) {}
+
+    uint32_t capacity() const { return N; }
+    // bytes dropped by DROP_NEW, skipped by DROP_OLD
+    uint32_t dropped() const { return load(&droppedNew) + load(&skippedOld); }
+
+    // consumer side
+    uint32_t fill() {
+        uint32_t h = load(&head);
+        return h - skip_overwritten(h);
+    }
+
+    // producer side
+    uint32_t room() {
+        uint32_t used = load(&head) - load(&tail);
+        return used < N ? N - used : 0;
+    }
+
+    // returns length, or 0 if DROP_NEW drops the data
+    uint32_t write(const uint8_t* data, uint32_t length) {
+        uint32_t h = head;
+        if(policy == SPSC_DROP_OLD) {
+            if(length > N) {
+                store(&droppedNew, droppedNew + length - N);
+                data += length - N;
+                length = N;
+            }
+            reserve(h + length);
+            copy_in(h, data, length);
+            store(&head, h + length);
+            return length;
+        }
+        if(policy == SPSC_DROP_NEW) {
+            if(length > room()) {
+                store(&droppedNew, droppedNew + length);
+                return 0;
+            }
+            copy_in(h, data, length);
+            store(&head, h + length);
+            return length;
+        }
+        uint32_t done = 0;
+        while(done < length) {
+            uint32_t n = room();
+            if(n > length - done)
+                n = length - done;
+            copy_in(h, data + done, n);
+            h += n;
+            store(&head, h);
+            done += n;
+        }
+        return length;
+    }
+
+    // up to length bytes, returns how many
+    uint32_t read(uint8_t* data, uint32_t length) {
+        uint32_t h = load(&head);
+        uint32_t t = skip_overwritten(h);
+        if(length > h - t)
+            length = h - t;
+        copy_out(t, data, length);
+        if(policy == SPSC_DROP_OLD) {
+            // the producer may have gone round while copying, the copy has
+            // to be done before reserved is looked at
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            uint32_t overwritten = __atomic_load_n(&reserved, __ATOMIC_RELAXED) - t;
+            overwritten = overwritten > N ? overwritten - N : 0;
+            if(overwritten >= length) {
+                store(&skippedOld, skippedOld + length);
+                store(&tail, t + length);
+                return 0;
+            }
+            if(overwritten) {
+                store(&skippedOld, skippedOld + overwritten);
+                memmove(data, data + overwritten, length - overwritten);
+            }
+            store(&tail, t + length);
+            return length - overwritten;
+        }
+        store(&tail, t + length);
+        return length;
+    }
+
+    // byte index after the oldest one, index < fill()
+    uint8_t peek(uint32_t index) const {
+        return data[(load(&tail) + index) & (N - 1)];
+    }
+
+    // as circularBuffer_read_spans, consume up to their length
+    uint32_t read_spans(struct circularBufferSpan span[2]) {
+        uint32_t h = load(&head);
+        uint32_t t = skip_overwritten(h);
+        return spans(t, h - t, span);
+    }
+    void consume(uint32_t n) {
+        store(&tail, tail + n);
+    }
+
+    // free room, commit up to its length. DROP_OLD hands out the whole ring,
+    // reads return nothing until the commit
+    uint32_t write_spans(struct circularBufferSpan span[2]) {
+        if(policy == SPSC_DROP_OLD) {
+            reserve(head + N);
+            return spans(head, N, span);
+        }
+        return spans(head, room(), span);
+    }
+    void commit(uint32_t n) {
+        if(policy == SPSC_DROP_OLD)
+            reserve(head + n);
+        store(&head, head + n);
+    }
+
+private:
+    static uint32_t load(const volatile uint32_t* p) {
+        return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+    }
+    static void store(volatile uint32_t* p, uint32_t value) {
+        __atomic_store_n(p, value, __ATOMIC_RELEASE);
+    }
+
+    // DROP_OLD producer: the bytes up to end are about to be overwritten,
+    // visible before any of them changes (as the counter of a seqlock)
+    void reserve(uint32_t end) {
+        __atomic_store_n(&reserved, end, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+    // consumer: the tail after what DROP_OLD overwrote
+    uint32_t skip_overwritten(uint32_t h) {
+        uint32_t t = tail;
+        if(policy == SPSC_DROP_OLD && h - t > N) {
+            store(&skippedOld, skippedOld + h - t - N);
+            t = h - N;
+            store(&tail, t);
+        }
+        return t;
+    }
+
+    uint32_t spans(uint32_t index, uint32_t length, struct circularBufferSpan span[2]) {
+        uint32_t start = index & (N - 1);
+        uint32_t first = N - start < length ? N - start : length;
+        span[0].data = data + start;
+        span[0].length = first;
+        span[1].data = data;
+        span[1].length = length - first;
+        return length;
+    }
+
+    void copy_in(uint32_t index, const uint8_t* p, uint32_t length) {
+        struct circularBufferSpan span[2];
+        spans(index, length, span);
+        memcpy(span[0].data, p, span[0].length);
+        memcpy(span[1].data, p + span[0].length, span[1].length);
+    }
+
+    void copy_out(uint32_t index, uint8_t* p, uint32_t length) {
+        struct circularBufferSpan span[2];
+        spans(index, length, span);
+        memcpy(p, span[0].data, span[0].length);
+        memcpy(p + span[0].length, span[1].data, span[1].length);
+    }
+
+    uint8_t data[N];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    // DROP_OLD: end of the bytes the producer is writing
+    volatile uint32_t reserved;
+    // each written by one side only
+    volatile uint32_t droppedNew;
+    volatile uint32_t skippedOld;
+};
+
+#endif // include guard
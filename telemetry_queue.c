@@ -0,0 +1,102 @@
+#include "telemetry_queue.h"
+#include "string.h"
+
+void telemetryQueue_init(struct telemetryQueue* q, uint8_t* storage, size_t size, uint32_t maxWait) {
+    size_t part = size / TELEMETRY_CLASSES;
+    for(uint8_t c = 0; c < TELEMETRY_CLASSES; c++) {
+        circularBuffer_init(&q->queue[c], storage + c * part, part);
+    }
+    q->maxWait = maxWait;
+    q->current = 0;
+    q->remaining = 0;
+    q->aged = 0;
+    telemetryQueue_reset_stats(q);
+}
+
+int telemetryQueue_push(struct telemetryQueue* q, uint8_t cls, const struct circularBufferSpan span[2], size_t length, uint32_t now) {
+    struct circularBuffer* cb = &q->queue[cls];
+    if(length > 255 || circularBuffer_capacity(cb) < TELEMETRY_QUEUE_HEADER + length) {
+        q->stats[cls].dropped++;
+        return 0;
+    }
+    uint8_t header[TELEMETRY_QUEUE_HEADER];
+    header[0] = length;
+    memcpy(header + 1, &now, sizeof(now));
+    circularBuffer_write(cb, header, sizeof(header));
+    size_t first = length < span[0].length ? length : span[0].length;
+    circularBuffer_write(cb, span[0].data, first);
+    if(length > first)
+        circularBuffer_write(cb, span[1].data, length - first);
+    return 1;
+}
+
+static uint32_t waited(struct circularBuffer* cb, uint32_t now) {
+    uint32_t stamp = 0;
+    for(uint8_t i = 0; i < sizeof(stamp); i++) {
+        stamp |= (uint32_t)circularBuffer_peek(cb, 1 + i) << (8 * i);
+    }
+    return now - stamp;
+}
+
+// class of the next message, TELEMETRY_CLASSES if there is none
+static uint8_t pick(struct telemetryQueue* q, uint32_t now) {
+    uint8_t first = TELEMETRY_CLASSES;
+    uint8_t oldest = TELEMETRY_CLASSES;
+    uint32_t longest = 0;
+    for(uint8_t c = 0; c < TELEMETRY_CLASSES; c++) {
+        if(!circularBuffer_fill(&q->queue[c]))
+            continue;
+        if(first == TELEMETRY_CLASSES)
+            first = c;
+        uint32_t w = waited(&q->queue[c], now);
+        if(w > q->maxWait && w > longest) {
+            oldest = c;
+            longest = w;
+        }
+    }
+    q->aged = !q->aged && oldest != TELEMETRY_CLASSES && oldest != first;
+    if(q->aged) {
+        q->stats[oldest].aged++;
+        return oldest;
+    }
+    return first;
+}
+
+size_t telemetryQueue_next(struct telemetryQueue* q, uint32_t now, const uint8_t** data) {
+    if(!q->remaining) {
+        uint8_t c = pick(q, now);
+        if(c == TELEMETRY_CLASSES)
+            return 0;
+        struct circularBuffer* cb = &q->queue[c];
+        uint32_t w = waited(cb, now);
+        q->current = c;
+        q->remaining = circularBuffer_peek(cb, 0);
+        circularBuffer_delete(cb, TELEMETRY_QUEUE_HEADER);
+        struct telemetryClassStats* s = &q->stats[c];
+        s->messages++;
+        s->latencySum += w;
+        if(w > s->latencyMax)
+            s->latencyMax = w;
+    }
+    struct circularBufferSpan span[2];
+    circularBuffer_read_spans(&q->queue[q->current], span);
+    *data = span[0].data;
+    return q->remaining < span[0].length ? q->remaining : span[0].length;
+}
+
+void telemetryQueue_done(struct telemetryQueue* q, size_t n) {
+    circularBuffer_consume(&q->queue[q->current], n);
+    q->remaining -= n;
+}
+
+size_t telemetryQueue_fill(struct telemetryQueue* q) {
+    size_t fill = 0;
+    for(uint8_t c = 0; c < TELEMETRY_CLASSES; c++) {
+        fill += circularBuffer_fill(&q->queue[c]);
+    }
+    return fill;
+}
+
+void telemetryQueue_reset_stats(struct telemetryQueue* q) {
+    memset(q->stats, 0, sizeof(q->stats));
+}
@@ -0,0 +1,53 @@
+#ifndef __telemetry_queue_h
+#define __telemetry_queue_h
+
+#include "inttypes.h"
+#include "stddef.h"
+#include "circular_buffer.h"
+
+/*
+ * Messages to the autopilot, one queue per class, sent one message at a
+ * time. The highest class with a message goes first. A message of a lower
+ * class that waited longer than maxWait goes ahead of it, but never twice in
+ * a row, so neither side can starve the other.
+ */
+enum telemetryClass {
+    TELEMETRY_CONTROL,      // control and safety
+    TELEMETRY_RANGING,      // own ranges, positions, time and ranging statistics
+    TELEMETRY_BULK,         // everything else
+    TELEMETRY_CLASSES
+};
+
+// in front of every queued message: its length and arrival time (us)
+#define TELEMETRY_QUEUE_HEADER 5
+
+struct telemetryClassStats {
+    uint32_t messages;      // sent
+    uint32_t dropped;       // no room in the queue
+    uint32_t aged;          // sent ahead of a higher class after maxWait
+    uint32_t latencySum;    // us in the queue, until the first byte goes out
+    uint32_t latencyMax;
+};
+
+struct telemetryQueue {
+    struct circularBuffer queue[TELEMETRY_CLASSES];
+    uint32_t maxWait;       // us
+    uint8_t current;        // class of the message being sent
+    uint16_t remaining;     // its bytes not handed out yet
+    uint8_t aged;           // the last message went ahead after maxWait
+    struct telemetryClassStats stats[TELEMETRY_CLASSES];
+};
+
+// storage is split evenly between the classes
+void telemetryQueue_init(struct telemetryQueue* q, uint8_t* storage, size_t size, uint32_t maxWait);
+// the first length bytes of the two pieces, returns 0 if the message is dropped
+int telemetryQueue_push(struct telemetryQueue* q, uint8_t cls, const struct circularBufferSpan span[2], size_t length, uint32_t now);
+// next piece to send, up to the end of the storage of its class. 0 if the queues are empty
+size_t telemetryQueue_next(struct telemetryQueue* q, uint32_t now, const uint8_t** data);
+// n bytes of the piece are sent and free again
+void telemetryQueue_done(struct telemetryQueue* q, size_t n);
+// bytes queued, all classes
+size_t telemetryQueue_fill(struct telemetryQueue* q);
+void telemetryQueue_reset_stats(struct telemetryQueue* q);
+
+#endif // include guard
@@ -0,0 +1,93 @@
+#include "time_sync.h"
+#include "clock_drift.h"
+
+static const uint64_t deviceWrap = TIMESYNC_DEVICE_MASK + 1;
+
+static uint8_t referenceAddr;
+static bool isReference;
+// reference: wraps of the own device time seen so far
+static uint64_t epoch;
+static uint64_t lastOwn;
+// follower: local device time and swarm time of the last TIME_SYNC reception
+static bool anchored;
+static uint64_t localAnchor;
+static uint64_t swarmAnchor;
+static uint32_t syncTime;
+
+void timesync_init(uint8_t reference, uint8_t self) {
+    referenceAddr = reference;
+    isReference = reference == self;
+    epoch = 0;
+    lastOwn = 0;
+    anchored = false;
+    localAnchor = 0;
+    swarmAnchor = 0;
+    syncTime = 0;
+}
+
+uint8_t timesync_reference() {
+    return referenceAddr;
+}
+
+uint64_t timesync_extend(const dwTime_t* local) {
+    uint64_t t = local->full & TIMESYNC_DEVICE_MASK;
+    if(t < lastOwn) {
+        // a jump back by more than half the range is a wrap, otherwise an older stamp
+        if(lastOwn - t > deviceWrap / 2) {
+            epoch += deviceWrap;
+            lastOwn = t;
+        }
+    } else if(t - lastOwn > deviceWrap / 2 && epoch >= deviceWrap) {
+        // older stamp from before the last wrap
+        return epoch - deviceWrap + t;
+    } else {
+        lastOwn = t;
+    }
+    return epoch + t;
+}
+
+void timesync_update(uint8_t addr, uint64_t swarmTx, const dwTime_t* localRx, double propTicks, uint32_t now) {
+    if(isReference || addr != referenceAddr)
+        return;
+    dwTime_t remoteTx = {.full = swarmTx & TIMESYNC_DEVICE_MASK};
+    drift_update_from_timestamps(addr, localRx, &remoteTx);
+    localAnchor = localRx->full & TIMESYNC_DEVICE_MASK;
+    swarmAnchor = swarmTx + (uint64_t)(propTicks + 0.5);
+    syncTime = now;
+    anchored = true;
+}
+
+bool timesync_synced(uint32_t now) {
+    double rate;
+    if(isReference)
+        return true;
+    return anchored && timesync_age(now) < TIMESYNC_TIMEOUT_US && drift_get_rate(referenceAddr, &rate);
+}
+
+uint32_t timesync_age(uint32_t now) {
+    if(isReference)
+        return 0;
+    return now - syncTime;
+}
+
+double timesync_skew() {
+    double rate;
+    if(isReference || !drift_get_rate(referenceAddr, &rate))
+        return 0;
+    return 1.0 / rate - 1.0;
+}
+
+bool timesync_to_swarm(const dwTime_t* local, uint64_t* swarm) {
+    if(isReference) {
+        *swarm = timesync_extend(local);
+        return true;
+    }
+    double rate;
+    if(!anchored || !drift_get_rate(referenceAddr, &rate))
+        return false;
+    // signed distance to the anchor, stamps before it are allowed
+    uint64_t d = (local->full - localAnchor) & TIMESYNC_DEVICE_MASK;
+    double delta = d > deviceWrap / 2 ? (double)d - deviceWrap : (double)d;
+    *swarm = swarmAnchor + (int64_t)(delta / rate);
+    return true;
+}
@@ -0,0 +1,43 @@
+#ifndef __time_sync_h
+#define __time_sync_h
+#include "inttypes.h"
+
+extern "C" {
+#include "libdw1000.h"
+}
+
+// the DW1000 system time wraps after 2^40 ticks (17.2s)
+#define TIMESYNC_DEVICE_MASK 0xFFFFFFFFFFULL
+// swarm time in sync frames: 40 bit device time and 16 bit wrap counter
+#define TIMESYNC_STAMP_SIZE 7
+#define TIMESYNC_STAMP_MASK 0xFFFFFFFFFFFFFFULL
+// without TIME_SYNC frames for this long a node is no longer synced (us),
+// has to stay well below the 17s wrap of the device time
+#define TIMESYNC_TIMEOUT_US 5000000
+
+// the swarm timebase is the DW1000 clock of the reference node, extended past
+// its wrap. Other nodes follow it from TIME_SYNC frames: the offset is taken
+// from the last frame (corrected by the propagation time), the skew comes
+// from the clock drift table.
+void timesync_init(uint8_t reference, uint8_t self);
+uint8_t timesync_reference();
+
+// reference only: swarm time of an own device timestamp. Counts the wraps,
+// has to see a timestamp at least every 17s (every TIME_SYNC frame does)
+uint64_t timesync_extend(const dwTime_t* local);
+
+// TIME_SYNC frame from addr: swarm time of its transmission, local reception
+// time and the propagation delay (ticks) if the range to addr is known
+void timesync_update(uint8_t addr, uint64_t swarmTx, const dwTime_t* localRx, double propTicks, uint32_t now);
+
+// false until the offset and the skew to the reference are known, and after a timeout
+bool timesync_synced(uint32_t now);
+// us since the last TIME_SYNC frame was used
+uint32_t timesync_age(uint32_t now);
+// reference ticks per local tick - 1
+double timesync_skew();
+
+// swarm time (ticks) of a local device timestamp younger than 17s, false if not synced
+bool timesync_to_swarm(const dwTime_t* local, uint64_t* swarm);
+
+#endif // include guard
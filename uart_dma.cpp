@@ -0,0 +1,151 @@
+#include "uart_dma.h"
+
+#if defined(TARGET_STM32L4)
+// DMA1 channels of the USARTs (request 2 on STM32L4)
+struct dmaChannel {
+    PinName pin;
+    USART_TypeDef* usart;
+    IRQn_Type usartIrq;
+    DMA_Channel_TypeDef* dma;
+    IRQn_Type dmaIrq;
+    uint8_t channel;
+};
+
+static const struct dmaChannel rxChannels[] = {
+    {PA_10, USART1, USART1_IRQn, DMA1_Channel5, DMA1_Channel5_IRQn, 5},
+    {PA_3, USART2, USART2_IRQn, DMA1_Channel6, DMA1_Channel6_IRQn, 6},
+};
+static const struct dmaChannel txChannels[] = {
+    {PA_9, USART1, USART1_IRQn, DMA1_Channel4, DMA1_Channel4_IRQn, 4},
+    {PA_2, USART2, USART2_IRQn, DMA1_Channel7, DMA1_Channel7_IRQn, 7},
+};
+#define DMA_REQUEST_USART 2
+
+static const struct dmaChannel* rx;
+static uint8_t* rxBuffer;
+static uint16_t rxSize;
+// first byte not yet handed to the callback
+static uint16_t rxTail;
+static uartDmaRxCallback rxCallback;
+
+static const struct dmaChannel* tx;
+static uartDmaTxCallback txCallback;
+
+static const struct dmaChannel* find_channel(const struct dmaChannel* channels, size_t count, PinName pin) {
+    for(size_t i = 0; i < count; i++) {
+        if(channels[i].pin == pin)
+            return &channels[i];
+    }
+    return NULL;
+}
+
+static void select_request(const struct dmaChannel* c) {
+    __HAL_RCC_DMA1_CLK_ENABLE();
+    uint32_t shift = 4 * (c->channel - 1);
+    DMA1_CSELR->CSELR = (DMA1_CSELR->CSELR & ~(0xFUL << shift)) | ((uint32_t)DMA_REQUEST_USART << shift);
+}
+
+static void clear_flags(const struct dmaChannel* c) {
+    DMA1->IFCR = DMA_IFCR_CGIF1 << (4 * (c->channel - 1));
+}
+
+// bytes between the tail and the DMA write position, in up to two pieces at the wrap
+static void rx_collect() {
+    uint16_t head = rxSize - rx->dma->CNDTR;
+    if(head >= rxSize)
+        head = 0;
+    if(head < rxTail) {
+        rxCallback(rxBuffer + rxTail, rxSize - rxTail);
+        rxTail = 0;
+    }
+    if(head > rxTail) {
+        rxCallback(rxBuffer + rxTail, head - rxTail);
+        rxTail = head;
+    }
+}
+
+static void rx_usart_irq() {
+    USART_TypeDef* usart = rx->usart;
+    uint32_t isr = usart->ISR;
+    // an overrun stops the reception until it is cleared
+    if(isr & (USART_ISR_ORE | USART_ISR_FE | USART_ISR_NE))
+        usart->ICR = USART_ICR_ORECF | USART_ICR_FECF | USART_ICR_NECF;
+    if(isr & USART_ISR_IDLE) {
+        usart->ICR = USART_ICR_IDLECF;
+        rx_collect();
+    }
+}
+
+static void rx_dma_irq() {
+    clear_flags(rx);
+    rx_collect();
+}
+
+bool uartDma_rx_start(PinName pin, uint8_t* buffer, uint16_t size, uartDmaRxCallback callback) {
+    rx = find_channel(rxChannels, sizeof(rxChannels) / sizeof(rxChannels[0]), pin);
+    if(!rx)
+        return false;
+    rxBuffer = buffer;
+    rxSize = size;
+    rxTail = 0;
+    rxCallback = callback;
+
+    select_request(rx);
+    rx->dma->CCR = 0;
+    rx->dma->CPAR = (uint32_t)&rx->usart->RDR;
+    rx->dma->CMAR = (uint32_t)buffer;
+    rx->dma->CNDTR = size;
+    rx->dma->CCR = DMA_CCR_MINC | DMA_CCR_CIRC | DMA_CCR_HTIE | DMA_CCR_TCIE;
+    NVIC_SetVector(rx->dmaIrq, (uint32_t)&rx_dma_irq);
+    NVIC_EnableIRQ(rx->dmaIrq);
+    rx->dma->CCR |= DMA_CCR_EN;
+
+    // the receive interrupt of the serial driver stays off, only idle line and errors
+    rx->usart->ICR = USART_ICR_IDLECF | USART_ICR_ORECF | USART_ICR_FECF | USART_ICR_NECF;
+    rx->usart->CR3 |= USART_CR3_DMAR | USART_CR3_EIE;
+    rx->usart->CR1 |= USART_CR1_IDLEIE;
+    NVIC_SetVector(rx->usartIrq, (uint32_t)&rx_usart_irq);
+    NVIC_EnableIRQ(rx->usartIrq);
+    return true;
+}
+
+// the last byte went to the USART, the data is free again
+static void tx_dma_irq() {
+    clear_flags(tx);
+    tx->dma->CCR = 0;
+    txCallback();
+}
+
+bool uartDma_tx_init(PinName pin, uartDmaTxCallback callback) {
+    tx = find_channel(txChannels, sizeof(txChannels) / sizeof(txChannels[0]), pin);
+    if(!tx)
+        return false;
+    txCallback = callback;
+    select_request(tx);
+    tx->dma->CCR = 0;
+    tx->dma->CPAR = (uint32_t)&tx->usart->TDR;
+    NVIC_SetVector(tx->dmaIrq, (uint32_t)&tx_dma_irq);
+    NVIC_EnableIRQ(tx->dmaIrq);
+    tx->usart->CR3 |= USART_CR3_DMAT;
+    return true;
+}
+
+void uartDma_tx_start(const uint8_t* data, uint16_t length) {
+    tx->dma->CCR = 0;
+    tx->dma->CMAR = (uint32_t)data;
+    tx->dma->CNDTR = length;
+    tx->dma->CCR = DMA_CCR_MINC | DMA_CCR_DIR | DMA_CCR_TCIE | DMA_CCR_EN;
+}
+#elif !defined(SIMULATION)
+// no DMA channels known for this target, the host simulation has sim/uart_dma_sim.cpp
+bool uartDma_rx_start(PinName pin, uint8_t* buffer, uint16_t size, uartDmaRxCallback callback) {
+    return false;
+}
+
+bool uartDma_tx_init(PinName pin, uartDmaTxCallback callback) {
+    return false;
+}
+
+void uartDma_tx_start(const uint8_t* data, uint16_t length) {
+}
+#endif
@@ -0,0 +1,28 @@
+#ifndef __uart_dma_h
+#define __uart_dma_h
+#include "mbed.h"
+#include "inttypes.h"
+
+/*
+ * Circular DMA reception for a serial port: the USART writes into buffer
+ * without any per byte interrupt. The callback gets what arrived so far when
+ * the line goes idle after a burst, and when half of buffer or all of it is
+ * filled, so nothing is overwritten as long as the callback keeps up with
+ * half a buffer of bytes. Interrupt context, as the RxIrq handlers.
+ */
+typedef void (*uartDmaRxCallback)(const uint8_t* data, uint16_t length);
+
+// start reception on the USART with pin rx, false if it has no DMA channel
+// (the port then has to stay with RxIrq)
+bool uartDma_rx_start(PinName rx, uint8_t* buffer, uint16_t size, uartDmaRxCallback callback);
+
+// DMA transmission, one transfer at a time. The callback (interrupt context)
+// runs when the data of the transfer is no longer needed
+typedef void (*uartDmaTxCallback)(void);
+
+// false if the USART with pin tx has no DMA channel
+bool uartDma_tx_init(PinName tx, uartDmaTxCallback callback);
+// data has to stay unchanged until the callback
+void uartDma_tx_start(const uint8_t* data, uint16_t length);
+
+#endif // include guard